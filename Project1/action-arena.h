@@ -0,0 +1,114 @@
+#ifndef __ACTION_ARENA_H
+#define __ACTION_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Monotonic memory for the temporaries of one action. Allocation is a
+ * pointer bump and freeing is a no-op; Reset() rewinds everything at once
+ * when the action is done. Running out of space adds a chunk, and chunks
+ * are kept across resets, so after the first few actions an action does
+ * not touch the heap at all.
+ */
+class ActionArena {
+public:
+	static const size_t kDefaultChunkBytes = 16 * 1024;
+
+	explicit ActionArena(const size_t chunkBytes = kDefaultChunkBytes) : chunkBytes_(chunkBytes) {}
+
+	ActionArena(const ActionArena&) = delete;
+	ActionArena& operator=(const ActionArena&) = delete;
+
+	void* Allocate(const size_t bytes, const size_t alignment)
+	{
+		while (true)
+		{
+			if (current_ < chunks_.size())
+			{
+				Chunk& chunk = chunks_[current_];
+				const auto base = reinterpret_cast<uintptr_t>(chunk.data.get());
+				const auto start = (base + offset_ + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+
+				if (start + bytes <= base + chunk.size)
+				{
+					offset_ = start + bytes - base;
+					used_ += bytes;
+					return reinterpret_cast<void*>(start);
+				}
+
+				current_++;
+				offset_ = 0;
+				continue;
+			}
+
+			//Oversized requests get a chunk of their own
+			const auto size = max(chunkBytes_, bytes + alignment);
+			chunks_.push_back(Chunk{ unique_ptr<char[]>(new char[size]), size });
+		}
+	}
+
+	// Rewinds to the first chunk, everything allocated since the last reset is gone.
+	void Reset()
+	{
+		highWater_ = max(highWater_, used_);
+		current_ = 0;
+		offset_ = 0;
+		used_ = 0;
+	}
+
+	size_t Used() const { return used_; }
+
+	size_t HighWater() const { return max(highWater_, used_); }
+
+	size_t Chunks() const { return chunks_.size(); }
+
+private:
+	struct Chunk {
+		unique_ptr<char[]> data;
+		size_t size;
+	};
+
+	vector<Chunk> chunks_;
+	size_t chunkBytes_;
+	size_t current_ = 0;
+	size_t offset_ = 0;
+	size_t used_ = 0;
+	size_t highWater_ = 0;
+};
+
+// Standard allocator over an ActionArena so containers can live in it.
+template <class T>
+class ArenaAllocator {
+public:
+	typedef T value_type;
+
+	explicit ArenaAllocator(ActionArena& arena) : arena_(&arena) {}
+
+	template <class U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena_) {}
+
+	T* allocate(const size_t count) { return static_cast<T*>(arena_->Allocate(count * sizeof(T), alignof(T))); }
+
+	void deallocate(T*, size_t) {}
+
+	template <class U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena_ == other.arena_; }
+
+	template <class U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return arena_ != other.arena_; }
+
+private:
+	template <class U>
+	friend class ArenaAllocator;
+
+	ActionArena* arena_;
+};
+
+#endif  // __ACTION_ARENA_H
@@ -0,0 +1,54 @@
+#ifndef __ALLOCATION_COUNTER_H
+#define __ALLOCATION_COUNTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+
+using namespace std;
+
+/**
+ * Heap allocation counting for debug builds. With BLOCKBATTLE_COUNT_ALLOCATIONS
+ * defined, main.cpp replaces the global operator new to bump a per-thread
+ * counter, and parsers check that actions past the warm-up allocate nothing.
+ * In other builds every call here compiles to nothing.
+ */
+class AllocationCounter {
+public:
+	// Actions that may still allocate while arenas and buffers find their size.
+	static const int kWarmupActions = 3;
+
+#ifdef BLOCKBATTLE_COUNT_ALLOCATIONS
+	static const bool kEnabled = true;
+#else
+	static const bool kEnabled = false;
+#endif
+
+	static uint64_t& ThreadCount()
+	{
+		thread_local uint64_t count = 0;
+		return count;
+	}
+
+	static void Record() { ThreadCount()++; }
+
+	// Reports an action that allocated after the warm-up.
+	static void CheckAction(const int session, const int action, const uint64_t allocations)
+	{
+		if (!kEnabled || action < kWarmupActions || allocations == 0)
+		{
+			return;
+		}
+
+		Failures()++;
+		cerr << "session " << session << ": action " << action << " made " << allocations << " heap allocations" << endl;
+	}
+
+	static atomic<long long>& Failures()
+	{
+		static atomic<long long> failures(0);
+		return failures;
+	}
+};
+
+#endif  // __ALLOCATION_COUNTER_H
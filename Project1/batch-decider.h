@@ -0,0 +1,261 @@
+#ifndef __BATCH_DECIDER_H
+#define __BATCH_DECIDER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "bit-board.h"
+#include "bot-config.h"
+#include "bot-starter.h"
+#include "cell.h"
+#include "ensemble-evaluator.h"
+#include "field.h"
+#include "move.h"
+#include "neural-evaluator.h"
+#include "worker-pool.h"
+
+using namespace std;
+
+/**
+ * Decisions for many positions in one call, for training and analysis
+ * tools that do not want to play a game through the text protocol.
+ * Positions and results are plain structs in caller memory. Every worker
+ * of the pool takes items off a shared counter and keeps its own
+ * BotStarter and Field between batches, so a batch does not allocate per
+ * item. Each decision is the two piece search of GetMoves without a time
+ * limit, the pattern cache, tree search and pondering are game features
+ * and are left out.
+ */
+class BatchDecider {
+public:
+	struct Record {
+		// Bit x of rows[y] is cell (x, y), y = 0 is the top row like in BitBoard.
+		uint16_t rows[BitBoard::kMaxHeight];
+		uint8_t width;
+		uint8_t height;
+		// Current shape in the low nibble, next shape in the high one.
+		uint8_t shapes;
+		// Solid rows at the bottom, they also have their bits set.
+		uint8_t solidRows;
+	};
+
+	struct Result {
+		float score;
+		// Placement of the current shape, anchored like PieceTable, -1 when nothing fits.
+		int8_t rotation;
+		int8_t x;
+		int8_t y;
+		// Moves from the spawn position, Move::MoveType values ending with DROP, 0 when nothing fits.
+		uint8_t moveCount;
+		uint8_t moves[BotStarter::kMaxMoveSet];
+	};
+
+	// Runs on the given pool as client, like a game session.
+	BatchDecider(const BotConfig& config, WorkerPool& pool, const int client)
+		: config_(config), pool_(&pool), client_(client)
+	{
+	}
+
+	// Starts its own pool of config.workerThreads on the first batch.
+	explicit BatchDecider(const BotConfig& config)
+		: config_(config), pool_(nullptr), client_(0)
+	{
+	}
+
+	BatchDecider(const BatchDecider&) = delete;
+	BatchDecider& operator=(const BatchDecider&) = delete;
+
+	//Network scoring the placements of every worker, shared and owned by the caller
+	void SetNeuralEvaluator(const NeuralEvaluator* neuralEvaluator)
+	{
+		neuralEvaluator_ = neuralEvaluator;
+
+		for (auto& worker : workers_)
+		{
+			worker->bot.SetNeuralEvaluator(neuralEvaluator);
+		}
+	}
+
+	//Weight sets scoring the placements of every worker, shared and owned by the caller
+	void SetEnsembleEvaluator(const EnsembleEvaluator* ensembleEvaluator)
+	{
+		ensembleEvaluator_ = ensembleEvaluator;
+
+		for (auto& worker : workers_)
+		{
+			worker->bot.SetEnsembleEvaluator(ensembleEvaluator);
+		}
+	}
+
+	/**
+	 * Writes the decision for records[i] to results[i] and returns once all
+	 * are done. Batches are run one at a time, a second caller waits.
+	 */
+	void Decide(const Record* records, const size_t count, Result* results)
+	{
+		lock_guard<mutex> lock(mutex_);
+
+		if (pool_ == nullptr)
+		{
+			ownPool_.reset(new WorkerPool(config_.workerThreads));
+			pool_ = ownPool_.get();
+		}
+
+		const auto slices = static_cast<int>(min(pool_->size(), (count + kChunk - 1) / kChunk));
+		while (workers_.size() < static_cast<size_t>(slices))
+		{
+			workers_.emplace_back(new Worker(config_));
+			workers_.back()->bot.SetNeuralEvaluator(neuralEvaluator_);
+			workers_.back()->bot.SetEnsembleEvaluator(ensembleEvaluator_);
+		}
+
+		//Small chunks off one counter keep the workers busy when some positions take longer
+		atomic<size_t> next(0);
+		pool_->ParallelFor(client_, 0, slices, [&](const int slice) {
+			Worker& worker = *workers_[slice];
+
+			for (auto begin = next.fetch_add(kChunk); begin < count; begin = next.fetch_add(kChunk))
+			{
+				const auto end = min(count, begin + kChunk);
+				for (auto i = begin; i < end; i++)
+				{
+					DecideOne(worker, records[i], results[i]);
+				}
+			}
+		});
+	}
+
+	/**
+	 * Fills a record from a field in the engine's notation, the shapes are
+	 * Shape::ShapeType values. Returns false if the field does not have the
+	 * given size or does not fit a record.
+	 */
+	static bool ParseRecord(const int width, const int height, const string& fieldStr, const int currentShape, const int nextShape,
+		Record& record)
+	{
+		if (width <= 0 || width > BitBoard::kMaxWidth || height <= 0 || height > BitBoard::kMaxHeight)
+		{
+			return false;
+		}
+
+		record = Record();
+		record.width = static_cast<uint8_t>(width);
+		record.height = static_cast<uint8_t>(height);
+		record.shapes = static_cast<uint8_t>((currentShape & 0xF) | (nextShape & 0xF) << 4);
+
+		auto cells = 0;
+		const char* position = fieldStr.c_str();
+		const char* const last = position + fieldStr.size();
+
+		while (position < last && cells < width * height)
+		{
+			char* next = nullptr;
+			const auto cellCode = static_cast<int>(strtol(position, &next, 10));
+			if (next == position)
+			{
+				return false;
+			}
+
+			const auto x = cells % width;
+			const auto y = cells / width;
+			if (cellCode == Cell::BLOCK || cellCode == Cell::SOLID)
+			{
+				record.rows[y] |= static_cast<uint16_t>(1u << x);
+			}
+			if (cellCode == Cell::SOLID)
+			{
+				record.solidRows = static_cast<uint8_t>(max<int>(record.solidRows, height - y));
+			}
+
+			cells++;
+			//Skips the ',' or ';' separator
+			position = next + 1;
+		}
+
+		return cells == width * height;
+	}
+
+private:
+	//Positions a worker takes off the counter at a time
+	static const size_t kChunk = 16;
+
+	struct Worker {
+		explicit Worker(const BotConfig& config) : bot(config) {}
+
+		BotStarter bot;
+		unique_ptr<Field> field;
+	};
+
+	static void DecideOne(Worker& worker, const Record& record, Result& result)
+	{
+		const auto currentShape = record.shapes & 0xF;
+		const auto nextShape = record.shapes >> 4;
+
+		result.score = 0.0f;
+		result.rotation = -1;
+		result.x = -1;
+		result.y = -1;
+		result.moveCount = 0;
+
+		if (record.width == 0 || record.width > BitBoard::kMaxWidth || record.height == 0 || record.height > BitBoard::kMaxHeight ||
+			currentShape >= PieceTable::kShapeCount || nextShape >= PieceTable::kShapeCount)
+		{
+			return;
+		}
+
+		BitBoard board(record.width, record.height);
+		for (auto y = 0; y < record.height; y++)
+		{
+			board.SetRow(y, record.rows[y]);
+		}
+		board.SetSolidRows(record.solidRows);
+
+		//The field is only reallocated when the size changes between positions
+		if (worker.field == nullptr || worker.field->width() != board.width() || worker.field->height() != board.height())
+		{
+			worker.field.reset(new Field(board));
+		}
+		else
+		{
+			worker.field->Load(board);
+		}
+
+		const auto decision = worker.bot.Decide(*worker.field, currentShape, nextShape);
+		if (!decision.found)
+		{
+			return;
+		}
+
+		//The engine spawns the box of the shape centred on the row above the field
+		const Point spawn((board.width() - PieceTable::BoxSize(currentShape)) / 2, -1);
+		Move::MoveType moves[BotStarter::kMaxMoveSet];
+		const auto moveCount = BotStarter::BuildMoves(currentShape, decision.rotation, spawn, decision.xPosition, moves);
+
+		result.score = static_cast<float>(decision.score);
+		result.rotation = static_cast<int8_t>(decision.rotation);
+		result.x = static_cast<int8_t>(decision.xPosition);
+		result.y = static_cast<int8_t>(decision.yPosition);
+		result.moveCount = static_cast<uint8_t>(moveCount);
+		for (auto i = 0; i < moveCount; i++)
+		{
+			result.moves[i] = static_cast<uint8_t>(moves[i]);
+		}
+	}
+
+	BotConfig config_;
+	WorkerPool* pool_;
+	unique_ptr<WorkerPool> ownPool_;
+	int client_;
+	const NeuralEvaluator* neuralEvaluator_ = nullptr;
+	const EnsembleEvaluator* ensembleEvaluator_ = nullptr;
+	vector<unique_ptr<Worker>> workers_;
+	mutex mutex_;
+};
+
+#endif  //__BATCH_DECIDER_H
@@ -0,0 +1,507 @@
+#ifndef __BIT_BOARD_H
+#define __BIT_BOARD_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+#include "piece-table.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+inline int PopCount(const uint32_t bits)
+{
+#ifdef _MSC_VER
+	return static_cast<int>(__popcnt(bits));
+#elif defined(__POPCNT__)
+	return __builtin_popcount(bits);
+#else
+	//Without the instruction the builtin is a library call, this inlines to a dozen operations
+	auto count = bits - ((bits >> 1) & 0x55555555u);
+	count = (count & 0x33333333u) + ((count >> 2) & 0x33333333u);
+	count = (count + (count >> 4)) & 0x0F0F0F0Fu;
+	return static_cast<int>((count * 0x01010101u) >> 24);
+#endif
+}
+
+inline int CountTrailingZeros(const uint32_t bits)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, bits);
+	return static_cast<int>(index);
+#else
+	return __builtin_ctz(bits);
+#endif
+}
+
+// Where a piece ends up: orientation and anchor as in PieceTable.
+struct Placement {
+	int8_t rotation;
+	int8_t x;
+	int8_t y;
+};
+
+/**
+ * Occupancy of a field as one bitmask per row plus a column skyline.
+ * Bit x of row y is set when cell (x, y) holds a block or solid cell,
+ * y = 0 is the top row like in Field. The skyline stores for every
+ * column the row of its highest occupied cell, or height when empty.
+ * It is a small value type so searches can copy it freely.
+ */
+class BitBoard {
+public:
+	static const int kMaxWidth = 16;
+	static const int kMaxHeight = 32;
+	static const int kMaxPlacements = PieceTable::kMaxRotations * kMaxWidth;
+	// The engine pushes a solid row in every round divisible by this.
+	static const int kRoundsPerSolidRow = 15;
+
+	BitBoard() : BitBoard(0, 0) {}
+
+	BitBoard(const int width, const int height) : width_(width), height_(height), solidRows_(0)
+	{
+		assert(width <= kMaxWidth && height <= kMaxHeight);
+
+		for (auto& row : rows_)
+		{
+			row = 0;
+		}
+		for (auto& top : tops_)
+		{
+			top = static_cast<int8_t>(height);
+		}
+	}
+
+	int width() const { return width_; }
+
+	int height() const { return height_; }
+
+	uint32_t FullRow() const { return (1u << width_) - 1; }
+
+	uint32_t Row(const int y) const { return rows_[y]; }
+
+	bool IsOccupied(const int x, const int y) const { return (rows_[y] >> x & 1) != 0; }
+
+	// Row of the highest occupied cell in the column, height() if it is empty.
+	int ColumnTop(const int x) const { return tops_[x]; }
+
+	int ColumnHeight(const int x) const { return height_ - tops_[x]; }
+
+	// Bit k is set when the cell k rows above the floor is occupied, see MaskTables::Column.
+	uint32_t ColumnMask(const int x) const
+	{
+		uint32_t column = 0;
+
+		for (auto y = tops_[x]; y < height_; y++)
+		{
+			column |= (rows_[y] >> x & 1u) << (height_ - 1 - y);
+		}
+
+		return column;
+	}
+
+	int SolidRows() const { return solidRows_; }
+
+	void Set(const int x, const int y, const bool occupied, const bool solid = false)
+	{
+		if (occupied)
+		{
+			rows_[y] |= 1u << x;
+
+			if (y < tops_[x])
+			{
+				tops_[x] = static_cast<int8_t>(y);
+			}
+		}
+		else
+		{
+			rows_[y] &= ~(1u << x);
+
+			if (y == tops_[x])
+			{
+				auto top = y + 1;
+				while (top < height_ && !IsOccupied(x, top))
+				{
+					top++;
+				}
+				tops_[x] = static_cast<int8_t>(top);
+			}
+		}
+
+		//Solid rows only ever fill the field from the bottom
+		if (solid && height_ - y > solidRows_)
+		{
+			solidRows_ = height_ - y;
+		}
+	}
+
+	// Overwrites a whole row, only the columns that change touch the skyline.
+	void SetRow(const int y, const uint32_t bits)
+	{
+		auto changed = (rows_[y] ^ bits) & FullRow();
+
+		while (changed != 0)
+		{
+			const auto x = CountTrailingZeros(changed);
+			Set(x, y, (bits >> x & 1) != 0);
+			changed &= changed - 1;
+		}
+	}
+
+	void SetSolidRows(const int solidRows) { solidRows_ = static_cast<int8_t>(solidRows); }
+
+	/**
+	 * Row the anchor of the orientation ends up on when dropped straight down
+	 * at column x, -1 if it does not fit. One max over the covered columns
+	 * of the skyline instead of testing every row.
+	 */
+	int LandingRow(const int shape, const int rotation, const int x) const
+	{
+		const PieceTable::Orientation& orientation = PieceTable::Get(shape, rotation);
+
+		if (x < 0 || x + orientation.width > width_)
+		{
+			return -1;
+		}
+
+		auto y = height_ - 1;
+		for (auto dx = 0; dx < orientation.width; dx++)
+		{
+			const auto resting = tops_[x + dx] - 1 - orientation.bottom[dx];
+			if (resting < y)
+			{
+				y = resting;
+			}
+		}
+
+		return y - (orientation.height - 1) >= 0 ? y : -1;
+	}
+
+	// Bitboard overlap test for positions that are not straight drops.
+	bool Fits(const int shape, const int rotation, const int x, const int y) const
+	{
+		const PieceTable::Orientation& orientation = PieceTable::Get(shape, rotation);
+
+		if (x < 0 || x + orientation.width > width_ || y >= height_ || y - (orientation.height - 1) < 0)
+		{
+			return false;
+		}
+
+		for (const auto& cell : orientation.cells)
+		{
+			if (IsOccupied(x + cell.dx, y + cell.dy))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	void Place(const int shape, const int rotation, const int x, const int y)
+	{
+		for (const auto& cell : PieceTable::Get(shape, rotation).cells)
+		{
+			Set(x + cell.dx, y + cell.dy, true);
+		}
+	}
+
+	void Remove(const int shape, const int rotation, const int x, const int y)
+	{
+		for (const auto& cell : PieceTable::Get(shape, rotation).cells)
+		{
+			Set(x + cell.dx, y + cell.dy, false);
+		}
+	}
+
+	// Writes every straight drop of the shape to out and returns how many there are.
+	int Placements(const int shape, Placement* out) const
+	{
+		auto count = 0;
+
+		for (auto rotation = 0; rotation < PieceTable::RotationCount(shape); rotation++)
+		{
+			for (auto x = 0; x < width_; x++)
+			{
+				const auto y = LandingRow(shape, rotation, x);
+
+				if (y >= 0)
+				{
+					out[count].rotation = static_cast<int8_t>(rotation);
+					out[count].x = static_cast<int8_t>(x);
+					out[count].y = static_cast<int8_t>(y);
+					count++;
+				}
+			}
+		}
+
+		return count;
+	}
+
+	// Removes completed rows above the solid rows and returns how many were cleared.
+	int ClearLines()
+	{
+		const auto full = FullRow();
+		auto target = height_ - solidRows_ - 1;
+
+		for (auto y = target; y >= 0; y--)
+		{
+			if (rows_[y] != full)
+			{
+				rows_[target--] = rows_[y];
+			}
+		}
+
+		const auto cleared = target + 1;
+		for (auto y = target; y >= 0; y--)
+		{
+			rows_[y] = 0;
+		}
+
+		if (cleared > 0)
+		{
+			RecomputeSkyline();
+		}
+
+		return cleared;
+	}
+
+	/**
+	 * Pushes everything up by one row and inserts a garbage row with a hole at
+	 * holeX above the solid rows, or a new solid row when holeX is negative.
+	 * Returns false when the top row overflows, which loses the game.
+	 */
+	bool PushRow(const int holeX)
+	{
+		const auto overflow = rows_[0] != 0;
+		const auto bottom = height_ - solidRows_ - 1;
+
+		for (auto y = 0; y < bottom; y++)
+		{
+			rows_[y] = rows_[y + 1];
+		}
+
+		if (holeX >= 0)
+		{
+			rows_[bottom] = static_cast<uint16_t>(FullRow() & ~(1u << holeX));
+		}
+		else
+		{
+			rows_[bottom] = static_cast<uint16_t>(FullRow());
+			solidRows_++;
+		}
+
+		RecomputeSkyline();
+		return !overflow;
+	}
+
+	// Empty cells with an occupied cell somewhere above them in the same column.
+	int HoleCount() const
+	{
+		uint32_t covered = 0;
+		auto holes = 0;
+
+		for (auto y = 0; y < height_; y++)
+		{
+			holes += PopCount(covered & ~rows_[y]);
+			covered |= rows_[y];
+		}
+
+		return holes;
+	}
+
+	// Holes of HoleCount by whether a piece can still get into them.
+	struct HoleClasses {
+		// Connected through empty cells to a cell open to the top, a piece may slide in under the overhang.
+		int overhangs;
+		// Closed off, only clearing the rows above opens them.
+		int sealed;
+	};
+
+	/**
+	 * Empty cells connected to the top through empty cells, bit x of
+	 * reachable[y]. A flood fill of whole rows: the cells with nothing
+	 * above them seed it, then every pass spreads it down the rows and back
+	 * up, and along each row, until a pass adds nothing. The rows above the
+	 * stack are open already and solid rows have no empty cells, so only the
+	 * rows in between are swept.
+	 */
+	void Reachable(uint32_t* reachable) const
+	{
+		const auto full = FullRow();
+		auto open = full;
+		int top = height_;
+
+		for (auto y = 0; y < height_; y++)
+		{
+			open &= ~rows_[y];
+			reachable[y] = open;
+			top = open != full && top == height_ ? y : top;
+		}
+
+		const int bottom = height_ - solidRows_;
+		for (auto changed = top < bottom; changed;)
+		{
+			changed = false;
+
+			for (auto y = max(top, 1); y < bottom; y++)
+			{
+				const auto row = SpreadRow(reachable[y] | reachable[y - 1], ~rows_[y] & full);
+				changed = changed || row != reachable[y];
+				reachable[y] = row;
+			}
+
+			for (auto y = bottom - 2; y >= top; y--)
+			{
+				const auto row = SpreadRow(reachable[y] | reachable[y + 1], ~rows_[y] & full);
+				changed = changed || row != reachable[y];
+				reachable[y] = row;
+			}
+		}
+	}
+
+	// Holes by class, the cells set in skip count as neither filled nor holes, nullptr for none.
+	HoleClasses ClassifyHoles(const uint32_t* skip = nullptr) const
+	{
+		uint32_t hidden[kMaxHeight];
+		uint32_t covered = 0;
+		uint32_t any = 0;
+
+		for (auto y = 0; y < height_; y++)
+		{
+			hidden[y] = covered & ~rows_[y] & ~(skip != nullptr ? skip[y] : 0u);
+			any |= hidden[y];
+			covered |= rows_[y];
+		}
+
+		HoleClasses holes = { 0, 0 };
+		if (any == 0)
+		{
+			return holes;
+		}
+
+		uint32_t reachable[kMaxHeight];
+		Reachable(reachable);
+
+		for (auto y = 0; y < height_; y++)
+		{
+			holes.overhangs += PopCount(hidden[y] & reachable[y]);
+			holes.sealed += PopCount(hidden[y] & ~reachable[y]);
+		}
+
+		return holes;
+	}
+
+	// Column x of the row becomes column width - 1 - x.
+	uint32_t ReverseRow(uint32_t row) const
+	{
+		uint32_t reversed = 0;
+
+		for (; row != 0; row &= row - 1)
+		{
+			reversed |= 1u << (width_ - 1 - CountTrailingZeros(row));
+		}
+
+		return reversed;
+	}
+
+	// The board reflected left to right, solid rows stay where they are.
+	BitBoard Mirrored() const
+	{
+		BitBoard mirrored(width_, height_);
+
+		for (auto y = 0; y < height_; y++)
+		{
+			mirrored.SetRow(y, ReverseRow(rows_[y]));
+		}
+		mirrored.solidRows_ = solidRows_;
+
+		return mirrored;
+	}
+
+	bool operator==(const BitBoard& other) const
+	{
+		if (width_ != other.width_ || height_ != other.height_ || solidRows_ != other.solidRows_)
+		{
+			return false;
+		}
+		for (auto y = 0; y < height_; y++)
+		{
+			if (rows_[y] != other.rows_[y])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool operator!=(const BitBoard& other) const { return !(*this == other); }
+
+	// Hash of everything operator== compares.
+	uint64_t Hash() const
+	{
+		uint64_t hash = static_cast<uint64_t>(width_) << 16 | static_cast<uint64_t>(height_) << 8 | static_cast<uint64_t>(solidRows_);
+
+		for (auto y = 0; y < height_; y++)
+		{
+			hash = (hash ^ rows_[y]) * 0x100000001B3ULL;
+			hash ^= hash >> 29;
+		}
+
+		return hash;
+	}
+
+private:
+	//The seed cells spread along the runs of empty cells they are in, both ways in four doubling steps each
+	static uint32_t SpreadRow(const uint32_t seed, const uint32_t empty)
+	{
+		auto left = seed & empty;
+		auto right = left;
+		auto leftEmpty = empty;
+		auto rightEmpty = empty;
+
+		left |= leftEmpty & left << 1;
+		leftEmpty &= leftEmpty << 1;
+		left |= leftEmpty & left << 2;
+		leftEmpty &= leftEmpty << 2;
+		left |= leftEmpty & left << 4;
+		leftEmpty &= leftEmpty << 4;
+		left |= leftEmpty & left << 8;
+
+		right |= rightEmpty & right >> 1;
+		rightEmpty &= rightEmpty >> 1;
+		right |= rightEmpty & right >> 2;
+		rightEmpty &= rightEmpty >> 2;
+		right |= rightEmpty & right >> 4;
+		rightEmpty &= rightEmpty >> 4;
+		right |= rightEmpty & right >> 8;
+
+		return left | right;
+	}
+
+	void RecomputeSkyline()
+	{
+		for (auto x = 0; x < width_; x++)
+		{
+			auto top = 0;
+			while (top < height_ && !IsOccupied(x, top))
+			{
+				top++;
+			}
+			tops_[x] = static_cast<int8_t>(top);
+		}
+	}
+
+	int8_t width_;
+	int8_t height_;
+	int8_t solidRows_;
+	int8_t tops_[kMaxWidth];
+	uint16_t rows_[kMaxHeight];
+};
+
+#endif  // __BIT_BOARD_H
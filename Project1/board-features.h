@@ -0,0 +1,219 @@
+#ifndef __BOARD_FEATURES_H
+#define __BOARD_FEATURES_H
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "bit-board.h"
+#include "mask-tables.h"
+#include "piece-table.h"
+
+using namespace std;
+
+/**
+ * The Dellacherie / El-Tetris feature set of a placement, next to the
+ * features of Field::CalculateMoveScore. Everything describes the
+ * board after the piece is locked and its lines are cleared, except the
+ * landing height and eroded cells which describe the piece itself.
+ */
+struct BoardFeatures {
+	// Height of the middle of the piece above the floor, before lines clear.
+	double landingHeight = 0.0;
+	// Lines the piece clears times its own cells in them.
+	int erodedPieceCells = 0;
+	int completedLines = 0;
+	// Filled/empty changes along each row, the side walls count as filled.
+	int rowTransitions = 0;
+	// Filled/empty changes down each column, the floor counts as filled.
+	int columnTransitions = 0;
+	// Empty cells with an occupied cell anywhere above them.
+	int holes = 0;
+	// Occupied cells above each hole in its column, summed over the holes.
+	int holeDepth = 0;
+	int rowsWithHoles = 0;
+	// Open cells between filled neighbours, a run of depth d counts 1 + 2 + ... + d.
+	int cumulativeWells = 0;
+	int sumOfHeights = 0;
+	int roughness = 0;
+	int maxHeight = 0;
+};
+
+// El-Tetris weights, the other features are left at zero.
+struct FeatureWeights {
+	double landingHeight = -4.500158825082766;
+	double erodedPieceCells = 3.4181268101392694;
+	double rowTransitions = -3.2178882868487753;
+	double columnTransitions = -9.348695305445199;
+	double holes = -7.899265427351652;
+	double holeDepth = 0.0;
+	double rowsWithHoles = 0.0;
+	double cumulativeWells = -3.3855972247263626;
+	double sumOfHeights = 0.0;
+	double roughness = 0.0;
+};
+
+namespace bitslice {
+
+// Per column counters kept as bit planes, plane k holds bit k of every column's count.
+static const int kPlanes = 6;
+
+// Adds one to the counters of the columns in mask.
+inline void Increment(uint32_t* planes, uint32_t mask)
+{
+	for (auto k = 0; k < kPlanes && mask != 0; k++)
+	{
+		const auto carry = planes[k] & mask;
+		planes[k] ^= mask;
+		mask = carry;
+	}
+}
+
+// Sum of the counters of the columns in mask.
+inline int Sum(const uint32_t* planes, const uint32_t mask)
+{
+	auto sum = 0;
+	for (auto k = 0; k < kPlanes && mask != 0; k++)
+	{
+		sum += PopCount(planes[k] & mask) << k;
+	}
+	return sum;
+}
+
+}  // namespace bitslice
+
+/**
+ * Extracts the features of dropping the orientation at (x, y), the anchor
+ * of PieceTable, in one pass over the rows from the top. Only the rows of
+ * the piece can complete, so they are checked first and the pass skips
+ * them as if they were already cleared. Per column counts (cells above a
+ * hole, depth of the current well run) live in bit planes, so each row
+ * costs a few shifts, ands and popcounts whatever the width.
+ */
+inline BoardFeatures ExtractFeatures(const BitBoard& board, const int shape, const int rotation, const int x, const int y)
+{
+	BoardFeatures features;
+	const PieceTable::Orientation& orientation = PieceTable::Get(shape, rotation);
+	const auto width = board.width();
+	const auto height = board.height();
+	const auto full = board.FullRow();
+
+	//Piece rows, piece[k] is row y - k
+	uint32_t piece[4] = { 0, 0, 0, 0 };
+	for (const auto& cell : orientation.cells)
+	{
+		piece[-cell.dy] |= 1u << (x + cell.dx);
+	}
+
+	uint32_t cleared = 0;
+	auto pieceCellsCleared = 0;
+	for (auto k = 0; k < orientation.height; k++)
+	{
+		const auto row = y - k;
+		if (row < height - board.SolidRows() && (board.Row(row) | piece[k]) == full)
+		{
+			cleared |= 1u << row;
+			pieceCellsCleared += PopCount(piece[k]);
+			features.completedLines++;
+		}
+	}
+	features.erodedPieceCells = features.completedLines * pieceCellsCleared;
+	features.landingHeight = (height - 1 - y) + (orientation.height - 1) / 2.0;
+
+	uint32_t covered = 0;
+	uint32_t previous = 0;
+	uint32_t above[bitslice::kPlanes] = {};
+	uint32_t wellRun[bitslice::kPlanes] = {};
+	uint32_t previousWells = 0;
+	int heights[BitBoard::kMaxWidth] = {};
+
+	//Empty rows above the stack only have their two wall transitions
+	auto top = y - (orientation.height - 1);
+	for (auto column = 0; column < width; column++)
+	{
+		top = board.ColumnTop(column) < top ? board.ColumnTop(column) : top;
+	}
+	features.rowTransitions += 2 * top;
+
+	for (auto row = top; row < height; row++)
+	{
+		if (cleared >> row & 1)
+		{
+			continue;
+		}
+
+		auto bits = board.Row(row);
+		if (row <= y && y - row < 4)
+		{
+			bits |= piece[y - row];
+		}
+
+		const auto walled = bits << 1 | 1u | 1u << (width + 1);
+
+		features.rowTransitions += MaskTables::Row(bits, width).transitions;
+		features.columnTransitions += PopCount(bits ^ previous);
+
+		const auto holes = covered & ~bits & full;
+		if (holes != 0)
+		{
+			features.holes += PopCount(holes);
+			features.rowsWithHoles++;
+			features.holeDepth += bitslice::Sum(above, holes);
+		}
+		bitslice::Increment(above, bits);
+
+		//Wall bit x of walled is the left neighbour of column x, bit x + 2 the right one
+		const auto wells = ~bits & ~covered & full & walled & walled >> 2;
+		//Runs are non-zero exactly in the well columns of the row above
+		if ((wells | previousWells) != 0)
+		{
+			for (auto k = 0; k < bitslice::kPlanes; k++)
+			{
+				wellRun[k] &= wells;
+			}
+			bitslice::Increment(wellRun, wells);
+			features.cumulativeWells += bitslice::Sum(wellRun, wells);
+		}
+		previousWells = wells;
+
+		auto tops = bits & ~covered;
+		if (tops != 0)
+		{
+			//Rows cleared below this one move it down
+			const auto rowHeight = height - row - (cleared != 0 ? PopCount(cleared >> row >> 1) : 0);
+			for (; tops != 0; tops &= tops - 1)
+			{
+				heights[CountTrailingZeros(tops)] = rowHeight;
+			}
+		}
+
+		covered |= bits;
+		previous = bits;
+	}
+
+	//Cleared rows come back as empty rows at the top, two wall transitions each
+	features.rowTransitions += 2 * features.completedLines;
+	features.columnTransitions += PopCount(~previous & full);
+
+	for (auto column = 0; column < width; column++)
+	{
+		features.sumOfHeights += heights[column];
+		features.maxHeight = heights[column] > features.maxHeight ? heights[column] : features.maxHeight;
+		if (column > 0)
+		{
+			features.roughness += abs(heights[column] - heights[column - 1]);
+		}
+	}
+
+	return features;
+}
+
+inline double ScoreFeatures(const BoardFeatures& features, const FeatureWeights& weights)
+{
+	return weights.landingHeight * features.landingHeight + weights.erodedPieceCells * features.erodedPieceCells +
+		weights.rowTransitions * features.rowTransitions + weights.columnTransitions * features.columnTransitions +
+		weights.holes * features.holes + weights.holeDepth * features.holeDepth + weights.rowsWithHoles * features.rowsWithHoles +
+		weights.cumulativeWells * features.cumulativeWells + weights.sumOfHeights * features.sumOfHeights +
+		weights.roughness * features.roughness;
+}
+
+#endif  // __BOARD_FEATURES_H
@@ -0,0 +1,164 @@
+#ifndef __BOT_CONFIG_H
+#define __BOT_CONFIG_H
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+/**
+ * Process wide options taken from the command line.
+ * Without any arguments the bot plays a single game over stdin/stdout.
+ */
+struct BotConfig {
+	// Unix socket path to serve many games from, empty for a single game.
+	string serverPath;
+	// Threads shared by all sessions in server mode, 0 for one per core.
+	unsigned int workerThreads = 0;
+	// Memory the server may commit to sessions.
+	size_t memoryBudgetMb = 512;
+	// Memory-mapped surface pattern cache, empty to disable it.
+	string patternCachePath;
+	size_t patternCacheMb = 64;
+	// Network weights replacing the linear move score, empty to keep it.
+	string neuralWeightsPath;
+	// Weight sets scoring placements together, see EnsembleEvaluator, empty for the field's own weights.
+	string ensemblePath;
+	// How the scores of the sets are combined: average or vote.
+	string ensembleCombine = "average";
+	// Compiled feature preset scoring placements, empty for the field's own score.
+	string evaluator;
+	// Dataset file every decision of the game is appended to, empty to disable it.
+	string recordPath;
+	// JSON lines report of hardware counters per search phase, "-" for stderr, empty to disable it.
+	string profilePath;
+	// Dataset file to summarise instead of playing, see GameDataset.
+	string datasetStatsPath;
+	// Perft known-answer file to run instead of playing, see PerftRunner.
+	string perftPath;
+	// Depth to run perft to, 0 for the expected depths of the file or all of its pieces.
+	int perftDepth = 0;
+	// Rounds to play against the built-in engine instead of a game, see SoakBenchmark.
+	long long soakRounds = 0;
+	// Drift the soak run allows between its baseline and last window.
+	size_t soakMemoryGrowthMb = 16;
+	double soakLatencyGrowth = 2.0;
+	// Bot command to referee matches against refereeOpponent with instead of a game, see Referee.
+	string refereeCommand;
+	// Opponent command, empty for the same one.
+	string refereeOpponent;
+	int refereeMatches = 100;
+	// Matches played at once, 0 for half the hardware threads.
+	unsigned int refereeThreads = 0;
+	// Scan the next piece on the predicted board between actions.
+	bool ponder = true;
+	// Skip placements and pairs whose bound cannot change the decision.
+	bool prune = true;
+	// Search critical boards deeper than the pair search of --engine, see SearchExtension. Not when a game sets the strategy.
+	bool extend = true;
+	// Search strategy, a name of SearchStrategies: greedy, pair (or heuristic), beam, deep or mcts.
+	string engine = "heuristic";
+	// Node pool of the tree search, about 120 bytes per node. 0 turns it off, games asking for mcts get --engine.
+	size_t mctsNodes = 200000;
+	// Threads of one tree search, 0 for one per core.
+	unsigned int searchThreads = 1;
+
+	static BotConfig Parse(int argc, char* argv[]) {
+		BotConfig config;
+
+		for (int i = 1; i < argc; ++i) {
+			const string flag = argv[i];
+			const bool hasValue = i + 1 < argc;
+
+			if (flag == "--server" && hasValue) {
+				config.serverPath = argv[++i];
+			}
+			else if (flag == "--workers" && hasValue) {
+				config.workerThreads = static_cast<unsigned int>(atoi(argv[++i]));
+			}
+			else if (flag == "--memory-mb" && hasValue) {
+				config.memoryBudgetMb = static_cast<size_t>(atoll(argv[++i]));
+			}
+			else if (flag == "--pattern-cache" && hasValue) {
+				config.patternCachePath = argv[++i];
+			}
+			else if (flag == "--pattern-cache-mb" && hasValue) {
+				config.patternCacheMb = static_cast<size_t>(atoll(argv[++i]));
+			}
+			else if (flag == "--neural-weights" && hasValue) {
+				config.neuralWeightsPath = argv[++i];
+			}
+			else if (flag == "--ensemble" && hasValue) {
+				config.ensemblePath = argv[++i];
+			}
+			else if (flag == "--ensemble-combine" && hasValue) {
+				config.ensembleCombine = argv[++i];
+			}
+			else if (flag == "--evaluator" && hasValue) {
+				config.evaluator = argv[++i];
+			}
+			else if (flag == "--record" && hasValue) {
+				config.recordPath = argv[++i];
+			}
+			else if (flag == "--profile" && hasValue) {
+				config.profilePath = argv[++i];
+			}
+			else if (flag == "--dataset-stats" && hasValue) {
+				config.datasetStatsPath = argv[++i];
+			}
+			else if (flag == "--perft" && hasValue) {
+				config.perftPath = argv[++i];
+			}
+			else if (flag == "--perft-depth" && hasValue) {
+				config.perftDepth = atoi(argv[++i]);
+			}
+			else if (flag == "--soak" && hasValue) {
+				config.soakRounds = atoll(argv[++i]);
+			}
+			else if (flag == "--soak-memory-mb" && hasValue) {
+				config.soakMemoryGrowthMb = static_cast<size_t>(atoll(argv[++i]));
+			}
+			else if (flag == "--soak-latency-growth" && hasValue) {
+				config.soakLatencyGrowth = atof(argv[++i]);
+			}
+			else if (flag == "--referee" && hasValue) {
+				config.refereeCommand = argv[++i];
+			}
+			else if (flag == "--opponent" && hasValue) {
+				config.refereeOpponent = argv[++i];
+			}
+			else if (flag == "--matches" && hasValue) {
+				config.refereeMatches = atoi(argv[++i]);
+			}
+			else if (flag == "--match-threads" && hasValue) {
+				config.refereeThreads = static_cast<unsigned int>(atoi(argv[++i]));
+			}
+			else if (flag == "--no-ponder") {
+				config.ponder = false;
+			}
+			else if (flag == "--no-prune") {
+				config.prune = false;
+			}
+			else if (flag == "--no-extend") {
+				config.extend = false;
+			}
+			else if (flag == "--engine" && hasValue) {
+				config.engine = argv[++i];
+			}
+			else if (flag == "--mcts-nodes" && hasValue) {
+				config.mctsNodes = static_cast<size_t>(atoll(argv[++i]));
+			}
+			else if (flag == "--search-threads" && hasValue) {
+				config.searchThreads = static_cast<unsigned int>(atoi(argv[++i]));
+			}
+			else {
+				cerr << "Cannot parse argument: " << flag << endl;
+			}
+		}
+
+		return config;
+	}
+};
+
+#endif  //__BOT_CONFIG_H
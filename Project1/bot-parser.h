@@ -4,12 +4,18 @@
 #ifndef __BOT_PARSER_H
 #define __BOT_PARSER_H
 
+#include <algorithm>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <vector>
 
+#include "allocation-counter.h"
+#include "batch-decider.h"
 #include "move.h"
 #include "bot-starter.h"
+#include "worker-pool.h"
 
 using namespace std;
 
@@ -19,50 +25,142 @@ using namespace std;
  */
 class BotParser {
 public:
-	BotParser(BotStarter& bot) : bot_(bot) {}
+	BotParser(BotStarter& bot) : bot_(bot), pool_(nullptr), session_(0) {}
 
-	void Run() {
+	// Runs the searches of this game on a shared pool instead of the calling thread.
+	BotParser(BotStarter& bot, WorkerPool& pool, int session)
+		: bot_(bot), pool_(&pool), session_(session) {}
+
+	// Answers "batch" commands with the decider, which is owned by the caller.
+	void SetBatchDecider(BatchDecider* batch) { batch_ = batch; }
+
+	void Run() { Run(cin, cout); }
+
+	void Run(istream& in, ostream& out) {
 		BotState currentState;
+		// Kept across commands so their buffers are reused instead of reallocated.
+		string command, part1, part2, part3;
+		// Points into the bot, which keeps the moves until its next action.
+		const vector<Move::MoveType>* moves = nullptr;
+		vector<BatchDecider::Record> batchRecords;
+		vector<BatchDecider::Result> batchResults;
+		int actions = 0;
+
+		// A round is counted from its first update to the flushed reply, the search on the thread it ran on.
+		// The jobs are built once, so handing them to the pool does not allocate.
+		bool roundStarted = false;
+		uint64_t roundStart = 0;
+		uint64_t searchAllocations = 0;
+		long long timebank = 0;
+		const function<void()> decide = [&] {
+			const auto before = AllocationCounter::ThreadCount();
+			moves = &bot_.GetMoves(currentState, timebank);
+			searchAllocations = AllocationCounter::ThreadCount() - before;
+		};
+		const function<void()> ponder = [&] { bot_.Ponder(currentState); };
 
 		while (true) {
-			string command;
-			cin >> command;
+			command.clear();
+			in >> command;
 			if (command == "settings") {
-				string part1, part2;
-				cin >> part1 >> part2;
+				in >> part1 >> part2;
 				//cerr << command << " " << part1 << " " << part2 << " " << endl;
 				currentState.UpdateSettings(part1, part2);
 			}
 			else if (command == "update") {
-				string part1, part2, part3;
-				cin >> part1 >> part2 >> part3;
+				if (!roundStarted) {
+					roundStart = AllocationCounter::ThreadCount();
+					roundStarted = true;
+				}
+				in >> part1 >> part2 >> part3;
 				//cerr << command << " " << part1 << " " << part2 << " " << part3 << " " << endl;
 				currentState.UpdateState(part1, part2, part3);
 			}
 			else if (command == "action") {
-				string output, moveJoin, part1;
-				long long part2;
-				cin >> part1 >> part2;
-				//cerr << command << " " << part1 << " " << part2 << " " << endl;
+				if (!roundStarted) {
+					roundStart = AllocationCounter::ThreadCount();
+				}
+				roundStarted = false;
 
-				vector<Move::MoveType> moves = bot_.GetMoves(currentState, part2);
+				in >> part1 >> timebank;
+				//cerr << command << " " << part1 << " " << timebank << " " << endl;
+				currentState.set_timebank(static_cast<int>(timebank));
 
-				if (moves.size() > 0) {
-					for (Move::MoveType move : moves) {
-						output += moveJoin;
-						output += Move::MoveToString(move);
-						moveJoin = ",";
-					}
+				if (pool_ != nullptr) {
+					pool_->Execute(session_, decide);
 				}
 				else {
-					output += "no_moves";
+					// The search ran on this thread and is already part of the round's count.
+					decide();
+					searchAllocations = 0;
+				}
+
+				WriteMoves(moves->begin(), moves->end(), out);
+				out.flush();
+				const auto allocations = AllocationCounter::ThreadCount() - roundStart + searchAllocations;
+				AllocationCounter::CheckAction(session_, actions++, allocations);
+				bot_.Timer().FinishAction();
+
+				// Prepares the next action while the engine plays the round, off the clock.
+				if (pool_ != nullptr) {
+					pool_->Execute(session_, ponder);
+				}
+				else {
+					ponder();
+				}
+			}
+			else if (command == "batch") {
+				// batch <count>, then one "<field> <this_piece_type> <next_piece_type>" per position,
+				// answered with one "<rotation> <x> <y> <score> <moves>" line each, in order.
+				// Positions are read and decided kBatchChunk at a time, the count only bounds the loop.
+				size_t count = 0;
+				in >> count;
+
+				// Without the field size the positions are read past and not answered, like without a decider
+				const auto sized = currentState.FieldWidth() > 0 && currentState.FieldHeight() > 0;
+				const auto answered = sized && batch_ != nullptr;
+				if (!sized) {
+					cerr << "Batch requests need the field_width and field_height settings first" << endl;
 				}
+				else if (batch_ == nullptr) {
+					cerr << "Batch requests are not enabled" << endl;
+				}
+
+				const size_t chunkSize = kBatchChunk;
+				for (size_t start = 0; start < count && in; start += chunkSize) {
+					const auto chunk = min(count - start, chunkSize);
+					batchRecords.resize(chunk);
+					batchResults.resize(chunk);
+
+					size_t read = 0;
+					for (; read < chunk && in >> part1 >> part2 >> part3; ++read) {
+						if (answered && !BatchDecider::ParseRecord(currentState.FieldWidth(), currentState.FieldHeight(), part1,
+							Shape::StringToShapeType(part2), Shape::StringToShapeType(part3), batchRecords[read])) {
+							cerr << "Unable to parse batch position " << start + read << endl;
+							batchRecords[read].width = 0;
+						}
+					}
 
-				//cerr << output << endl;
-				cout << output << endl;
+					if (!answered) {
+						continue;
+					}
+
+					batch_->Decide(batchRecords.data(), read, batchResults.data());
+
+					for (size_t i = 0; i < read; ++i) {
+						const BatchDecider::Result& result = batchResults[i];
+						out << static_cast<int>(result.rotation) << ' ' << static_cast<int>(result.x) << ' '
+							<< static_cast<int>(result.y) << ' ' << result.score << ' ';
+						WriteMoves(result.moves, result.moves + result.moveCount, out);
+					}
+				}
+				out.flush();
 			}
 			else if (command.size() == 0) {
 				// no more commands, exit.
+				if (actions > 0) {
+					bot_.GameOver(currentState);
+				}
 				break;
 			}
 			else {
@@ -72,7 +170,28 @@ public:
 	}
 
 private:
+	// Batch positions held at once, the records and results of a chunk are a few hundred KB.
+	static const size_t kBatchChunk = 4096;
+
+	// Writes the moves straight to the stream, no joined string is built.
+	template <typename MoveIterator>
+	static void WriteMoves(MoveIterator begin, MoveIterator end, ostream& out) {
+		if (begin == end) {
+			out << "no_moves";
+		}
+		for (MoveIterator move = begin; move != end; ++move) {
+			if (move != begin) {
+				out << ',';
+			}
+			out << Move::MoveName(static_cast<Move::MoveType>(*move));
+		}
+		out << '\n';
+	}
+
 	BotStarter& bot_;
+	WorkerPool* pool_;
+	int session_;
+	BatchDecider* batch_ = nullptr;
 };
 
 #endif  //__BOT_PARSER_H
@@ -4,13 +4,30 @@
 #ifndef __BOT_STARTER_H
 #define __BOT_STARTER_H
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <limits>
 #include <vector>
 
+#include "action-arena.h"
+#include "bot-config.h"
 #include "bot-state.h"
+#include "composed-evaluator.h"
+#include "ensemble-evaluator.h"
+#include "game-dataset.h"
+#include "mcts.h"
+#include "mirror.h"
 #include "move.h"
+#include "neural-evaluator.h"
+#include "pair-collisions.h"
+#include "pattern-cache.h"
+#include "phase-profiler.h"
+#include "placement-stream.h"
+#include "search-extension.h"
+#include "search-strategy.h"
+#include "time-manager.h"
 
-#include <fstream>
 
 using namespace std;
 
@@ -20,195 +37,869 @@ using namespace std;
  */
 class BotStarter {
 public:
+	//Placement of the current piece chosen by the two piece search, the score is the total of the pair
+	struct Decision {
+		int rotation = 0;
+		int xPosition = 0;
+		int yPosition = 0;
+		double score = -10000000.0;
+		bool found = false;
+	};
+
+	//Three turns, a move to every column and the drop
+	static const int kMaxMoveSet = 4 + BitBoard::kMaxWidth;
+
+	//Score, rotation, position, in arena memory
+	typedef ArenaAllocator<pair<const float, tuple<int, Point>>> RankingAllocator;
+	typedef multimap<float, tuple<int, Point>, greater<>, RankingAllocator> MoveRanking;
+
+	explicit BotStarter(const BotConfig& config = BotConfig())
+		: ponder_(config.ponder), prune_(config.prune), extend_(config.extend), mctsEnabled_(config.mctsNodes > 0),
+		mcts_(config.mctsNodes, config.searchThreads)
+	{
+		moveSet_.reserve(kMaxMoveSet);
+
+		const auto strategy = SearchStrategies::Find(config.engine);
+		strategy_ = strategy >= 0 && (strategy != SearchStrategies::MCTS || mctsEnabled_) ? strategy : SearchStrategies::PAIR;
+
+		if (!config.evaluator.empty())
+		{
+			placementEvaluator_ = EvaluatorRegistry::FindPlacement(config.evaluator);
+			if (placementEvaluator_ == nullptr)
+			{
+				composedEvaluator_ = EvaluatorRegistry::Find(config.evaluator);
+			}
+		}
+	}
+
 	/**
 	 * Returns a random amount of random moves
 	 * @param state : current state of the bot
 	 * @param timeout : time to respond
 	 * @return : a list of moves to execute
 	 */
-	vector<Move::MoveType> GetMoves(BotState& state,long long timeout) {
+	const vector<Move::MoveType>& GetMoves(BotState& state,long long timeout) {
 
-		vector<Move::MoveType> bestMoveSet;
+		//Everything the search allocates lives in the arena and is dropped here, one action later
+		arena_.Reset();
+		moveSet_.clear();
 
-		//Score, rotation, position
-		multimap<float, tuple<int, Point>, greater<>> pieceOneAllPossibleMoves = {};
-		multimap<float, tuple<int, Point>, greater<>> pieceTwoAllPossibleMoves = {};
+		if (profiler_ != nullptr)
+		{
+			profiler_->StartAction(state.Round());
+		}
+
+		timeManager_.SetLimits(state.MaxTimebank(), state.TimePerMove());
+		const auto deadline = timeManager_.StartAction(timeout, state.MyField());
 
-		auto rotation = 0;
-		auto xPosition = 0;
-		auto yPosition = 0;
+		const auto strategy = Extend(state);
 
-		if (!state.MyField().DetectGameLoss())
+		//The boards of the lookahead are made on the first action, an extended search later on allocates nothing
+		for (auto& lookaheadField : lookaheadFields_)
 		{
-			ofstream foutStream;
+			if (lookaheadField == nullptr)
+			{
+				lookaheadField.reset(new Field(state.MyField()));
+			}
+		}
 
-			foutStream.open("test.txt", fstream::out);
+		//Surface patterns solved in earlier actions or games skip the search entirely, the cache holds pair search decisions
+		PatternCache::Pattern pattern = {};
+		const auto cacheable = strategy == SearchStrategies::PAIR && patternCache_ != nullptr && PatternCache::Cacheable(state.MyField());
 
-			foutStream << "We're Winning!" << endl;
+		if (cacheable)
+		{
+			pattern = PatternCache::Key(state.MyField(), state.CurrentShape(), state.NextShape());
+
+			//Entries of mirrored patterns are placements of the mirrored shape on the mirrored board
+			PatternCache::Entry entry;
+			const auto cachedShape = pattern.mirrored ? Mirror::Shape(state.CurrentShape()) : state.CurrentShape();
+
+			if (patternCache_->Lookup(pattern, entry) && entry.rotation < PieceTable::RotationCount(cachedShape))
+			{
+				auto placement = Placement{ entry.rotation, entry.xPosition, 0 };
+				if (pattern.mirrored)
+				{
+					placement = Mirror::Reflect(cachedShape, placement, state.MyField().width());
+				}
 
-			foutStream.close();
+				if (state.MyField().LandingRow(state.CurrentShape(), placement.rotation, placement.x) >= 0)
+				{
+					return FinishMove(state, placement.rotation, placement.x, entry.score);
+				}
+			}
 		}
-		else
+
+		const auto started = TimeManager::Clock::now();
+		nodes_ = 0;
+
+		Decision best;
+		switch (strategy)
 		{
-			ofstream foutStream;
+		case SearchStrategies::GREEDY:
+			best = SearchGreedy(state);
+			break;
+		case SearchStrategies::BEAM:
+			best = SearchLookahead(state, 2, deadline);
+			break;
+		case SearchStrategies::DEEP:
+			best = SearchLookahead(state, 3, deadline);
+			break;
+		case SearchStrategies::MCTS:
+			best = SearchMcts(state, deadline);
+			if (!best.found)
+			{
+				best = SearchPair(state, deadline);
+			}
+			break;
+		default:
+			best = SearchPair(state, deadline);
+			break;
+		}
 
-			foutStream.open("test.txt", fstream::out);
+		auto& stats = stats_[strategy];
+		stats.actions++;
+		stats.nodes += nodes_;
+		stats.nanoseconds += chrono::duration_cast<chrono::nanoseconds>(TimeManager::Clock::now() - started).count();
 
-			foutStream << "We Lost!" << endl;
+		if (cacheable && best.found)
+		{
+			auto placement = Placement{ static_cast<int8_t>(best.rotation), static_cast<int8_t>(best.xPosition), static_cast<int8_t>(best.yPosition) };
+			if (pattern.mirrored)
+			{
+				placement = Mirror::Reflect(state.CurrentShape(), placement, state.MyField().width());
+			}
 
-			foutStream.close();
+			patternCache_->Store(pattern, placement.rotation, placement.x, best.score);
 		}
 
-		const auto solidRowCount = state.MyField().SolidRowCount();
+		return FinishMove(state, best.rotation, best.xPosition, static_cast<float>(best.score));
+	}
 
-		//cerr << "Number of Solid Rows: " << solidRowCount << endl;
+	/**
+	 * The two piece search alone, for positions that do not come from the
+	 * engine. No time limit, pattern cache, tree search or pondering, the
+	 * rankings live in the arena like in GetMoves.
+	 */
+	Decision Decide(Field& field, const int currentShape, const int nextShape)
+	{
+		arena_.Reset();
+
+		MoveRanking pieceOneAllPossibleMoves{ RankingAllocator(arena_) };
+		ScoredPlacement scored[BitBoard::kMaxPlacements];
+
+		Rank(scored, ScanPlacements(field, currentShape, scored), pieceOneAllPossibleMoves);
+
+		PlacementStream pieceTwo;
+		StreamPlacements(field, nextShape, pieceTwo);
+
+		return PairSearch(currentShape, nextShape, pieceOneAllPossibleMoves, pieceTwo, TimeManager::Clock::time_point::max());
+	}
 
-		//cerr << "Current Piece: " << endl;
+	//Turns a target rotation and column into the moves that bring the shape there from its box location, returns how many were written
+	static int BuildMoves(const int shape, const int bestRotation, const Point location, const int bestXPosition, Move::MoveType* moves)
+	{
+		auto count = 0;
+
+		//Add translation to moveset
+		auto xCurrentPosition = location.first;
+		auto yCurrentPosition = location.second;
+
+		//cerr << "CurrentXPosition: " << xCurrentPosition << " CurrentYPosition: " << yCurrentPosition << endl;
+
+		CorrectCurrentPosition(shape, bestRotation, xCurrentPosition, yCurrentPosition);
+
+		//cerr << "AdjustedXPosition: " << xCurrentPosition << " AdjustedYPosition: " << yCurrentPosition << endl;
+
+		//Add rotations to moveset
+		for (auto i = 0; i < bestRotation; i++)
+		{
+			moves[count++] = Move::MoveType::TURNRIGHT;
+		}
+
+		if (xCurrentPosition < bestXPosition)
+		{
+			while (xCurrentPosition != bestXPosition)
+			{
+				moves[count++] = Move::MoveType::RIGHT;
+				xCurrentPosition++;
+			}
+		}
 
-		//Get all possible moves for the current piece
-		//Loop through each possible rotation
-		for (rotation = 0; rotation < 4; rotation++)
+		if (xCurrentPosition > bestXPosition)
 		{
-			//Loop through the grid, start from the bottom left
-			for (xPosition = 0; xPosition < state.MyField().width(); xPosition++)
+			while (xCurrentPosition != bestXPosition)
 			{
-				for (yPosition = state.MyField().height() - (1 + solidRowCount); yPosition >= 0;  yPosition--)
-				{
-					double moveScore = 0.0f;
+				moves[count++] = Move::MoveType::LEFT;
+				xCurrentPosition--;
+			}
+		}
 
-					//Checks if position is valid for the shape and is accessible
-					if (state.MyField().CheckValidShapePosition(state.CurrentShape(), rotation, xPosition, yPosition, moveScore))
-					{
-						//We'll just insert a max of the five best possible moves, we ignore moves that produce the same score
-						pieceOneAllPossibleMoves.insert(pieceOneAllPossibleMoves.begin(), make_pair(moveScore, make_tuple(rotation, make_pair(xPosition, yPosition))));
+		moves[count++] = Move::MoveType::DROP;
+		return count;
+	}
 
-						//cerr << "Possible position with rotation " << rotation << " at position x" << xPosition << " y" << yPosition << endl << endl;
-						break;
-					}
+	TimeManager& Timer() { return timeManager_; }
+
+	//The cache is owned by the caller so several bots can share it
+	void SetPatternCache(PatternCache* patternCache) { patternCache_ = patternCache; }
+
+	//Replaces the linear move score with a loaded network, shared and owned by the caller
+	void SetNeuralEvaluator(const NeuralEvaluator* neuralEvaluator) { neuralEvaluator_ = neuralEvaluator; }
+
+	//Replaces the field's weights with loaded weight sets, shared and owned by the caller
+	void SetEnsembleEvaluator(const EnsembleEvaluator* ensembleEvaluator) { ensembleEvaluator_ = ensembleEvaluator; }
+
+	//Decisions are appended to the recorder, which is owned by the caller
+	void SetRecorder(GameRecorder* recorder) { recorder_ = recorder; }
+
+	//Search phases are counted by the profiler, which is owned by the caller
+	void SetProfiler(PhaseProfiler* profiler) { profiler_ = profiler; }
+
+	/**
+	 * Runs after the moves went out, while the engine plays the round.
+	 * Predicts the next board from the placement just chosen and scans the
+	 * next piece on it, the next action only scans the newly revealed piece
+	 * if the prediction holds. Garbage or solid rows make it miss.
+	 */
+	void Ponder(const BotState& state)
+	{
+		if (!decided_ || !ponder_ || ActiveStrategy(state) == SearchStrategies::MCTS)
+		{
+			return;
+		}
+		decided_ = false;
+
+		const Field& field = state.MyField();
+		if (predictedField_ == nullptr)
+		{
+			predictedField_.reset(new Field(field));
+		}
+		else
+		{
+			*predictedField_ = field;
+		}
+
+		predictedField_->ApplyPlacement(state.CurrentShape(), decision_.rotation, decision_.x, decision_.y);
+
+		pondered_.board = predictedField_->Board();
+		pondered_.shape = state.NextShape();
+		Profile(PhaseProfiler::PONDER);
+		pondered_.count = ScanPlacements(*predictedField_, state.NextShape(), pondered_.scored);
+		if (profiler_ != nullptr)
+		{
+			profiler_->Leave();
+		}
+	}
+
+	long long ReuseHits() const { return reuseHits_; }
+
+	long long ReuseMisses() const { return reuseMisses_; }
+
+	//Called once the engine stops sending, closes the recorded game
+	void GameOver(const BotState& state)
+	{
+		if (reuseHits_ + reuseMisses_ > 0)
+		{
+			cerr << "reused the pondered scan in " << reuseHits_ << " of " << reuseHits_ + reuseMisses_ << " searches" << endl;
+		}
+
+		if (placementsTotal_ > 0 || pairsVisited_ > 0)
+		{
+			cerr << "pruning: scored " << placementsScored_ << " of " << placementsTotal_ << " bounded placements, visited "
+				<< pairsVisited_ << " of " << pairsTotal_ << " pairs" << endl;
+		}
+
+		for (auto kind = 0; kind < SearchStrategies::COUNT; kind++)
+		{
+			const auto& stats = stats_[kind];
+			if (stats.actions > 0)
+			{
+				cerr << "strategy " << SearchStrategies::Name(kind) << ": " << stats.actions << " actions, " << stats.nodes / stats.actions
+					<< " nodes and " << stats.nanoseconds / stats.actions / 1000 << " us per action, "
+					<< (stats.nanoseconds > 0 ? static_cast<long long>(stats.nodes * 1e9 / stats.nanoseconds) : 0) << " nodes/s";
+				if (stats.reused > 0)
+				{
+					cerr << ", reused the tree in " << stats.reused << " actions";
 				}
+				cerr << endl;
 			}
 		}
 
-		//cerr << endl << "Next Piece: " << endl;
+		if (profiler_ != nullptr)
+		{
+			profiler_->EndGame();
+		}
 
-		//Get all possible moves for the next piece
-		//Loop through each possible rotation
-		for (rotation = 0; rotation < 4; rotation++)
+		if (recorder_ == nullptr)
 		{
-			//Loop through the grid, start from the bottom left
-			for (xPosition = 0; xPosition < state.MyField().width(); xPosition++)
+			return;
+		}
+
+		//The engine does not announce the winner, the taller stack at the last update is the one that topped out
+		const auto myHeight = state.MyField().MaxColumnHeight();
+		const auto opponentHeight = state.OpponentField().MaxColumnHeight();
+		recorder_->EndGame(myHeight < opponentHeight ? 1 : (myHeight > opponentHeight ? -1 : 0));
+	}
+
+private:
+	//Placements of each piece the pair search looks at
+	static const int kLookAhead = 10;
+	//Placements of each known piece the beam and deep searches play out
+	static const int kBeamWidth = 5;
+	//Pieces the deep search looks at, the current, the next and an unknown one
+	static const int kMaxDepth = 3;
+
+	int ActiveStrategy(const BotState& state) const
+	{
+		//A game can ask for another strategy than the one the bot was started with, the tree search only when it has a pool
+		const auto requested = state.SearchStrategy();
+		return requested >= 0 && (requested != SearchStrategies::MCTS || mctsEnabled_) ? requested : strategy_;
+	}
+
+	//Critical boards get the searches that play placements out, with two or more signs the deep one.
+	//Only the pair search the bot was started with is extended, a strategy the game asked for is kept as it is.
+	int Extend(const BotState& state)
+	{
+		if (state.SearchStrategy() == SearchStrategies::MCTS && !mctsEnabled_ && !mctsRefused_)
+		{
+			cerr << "The tree search has no node pool here, playing " << SearchStrategies::Name(strategy_) << " instead" << endl;
+			mctsRefused_ = true;
+		}
+
+		const auto strategy = ActiveStrategy(state);
+		if (!extend_ || state.SearchStrategy() >= 0 || strategy != SearchStrategies::PAIR)
+		{
+			return strategy;
+		}
+
+		const auto signs = SearchExtension::Signs(state.MyField().Board(), state.Round());
+		return signs >= 2 ? SearchStrategies::DEEP : (signs == 1 ? SearchStrategies::BEAM : strategy);
+	}
+
+	//The current piece's scan, the pondered one when the board is the one it was predicted on
+	const ScoredPlacement* ScanCurrent(BotState& state, ScoredPlacement* scored, int& count)
+	{
+		if (pondered_.count > 0 && pondered_.shape == state.CurrentShape() && pondered_.board == state.MyField().Board())
+		{
+			count = pondered_.count;
+			pondered_.count = 0;
+			reuseHits_++;
+			return pondered_.scored;
+		}
+
+		pondered_.count = 0;
+		Profile(PhaseProfiler::SCAN);
+		count = ScanPlacements(state.MyField(), state.CurrentShape(), scored);
+		nodes_ += count;
+		reuseMisses_++;
+		return scored;
+	}
+
+	//Best placement of the current piece, nothing else considered
+	Decision SearchGreedy(BotState& state)
+	{
+		ScoredPlacement scored[BitBoard::kMaxPlacements];
+		auto count = 0;
+		const auto current = ScanCurrent(state, scored, count);
+
+		Decision best;
+		int index;
+		if (BestPlacements(current, count, &index, 1) > 0)
+		{
+			SetDecision(current[index].placement, current[index].score, best);
+		}
+		return best;
+	}
+
+	//The pieces of the round paired on the same board, see PairSearch
+	Decision SearchPair(BotState& state, const TimeManager::Clock::time_point deadline)
+	{
+		//Score, rotation, position
+		MoveRanking pieceOneAllPossibleMoves{ RankingAllocator(arena_) };
+
+		//Get all possible moves for both pieces, the skyline gives the landing row of every rotation and column.
+		//When the board is the one predicted last action the current piece was already scanned while idle.
+		ScoredPlacement scored[BitBoard::kMaxPlacements];
+		auto count = 0;
+		const auto current = ScanCurrent(state, scored, count);
+
+		Profile(PhaseProfiler::RANK);
+		Rank(current, count, pieceOneAllPossibleMoves);
+
+		//The next piece is only scored as far as the pair search pulls it
+		Profile(PhaseProfiler::SCAN);
+		PlacementStream pieceTwo;
+		StreamPlacements(state.MyField(), state.NextShape(), pieceTwo);
+
+		Profile(PhaseProfiler::PAIR);
+		return PairSearch(state.CurrentShape(), state.NextShape(), pieceOneAllPossibleMoves, pieceTwo, deadline);
+	}
+
+	/**
+	 * Unlike the pair search the placements are played out, lines they
+	 * complete are cleared before the next piece is scanned. The kBeamWidth
+	 * best placements of the current piece are each followed by the best
+	 * placement of the next piece, with a depth of 3 by the kBeamWidth best
+	 * ones of the next piece followed by the average of the best placement
+	 * of every shape. The current placement with the best total is chosen,
+	 * the ones not tried by the deadline are skipped.
+	 */
+	Decision SearchLookahead(BotState& state, const int depth, const TimeManager::Clock::time_point deadline)
+	{
+		ScoredPlacement scored[BitBoard::kMaxPlacements];
+		auto count = 0;
+		const auto current = ScanCurrent(state, scored, count);
+
+		Profile(PhaseProfiler::SCAN);
+		int beam[kBeamWidth];
+		const auto width = BestPlacements(current, count, beam, kBeamWidth);
+
+		Decision best;
+		for (auto i = 0; i < width; i++)
+		{
+			if (i > 0 && TimeManager::Clock::now() >= deadline)
 			{
-				for (yPosition = state.MyField().height() - 1; yPosition >= 0; yPosition--)
+				break;
+			}
+
+			const auto& candidate = current[beam[i]];
+			const auto score = candidate.score + PlayOut(state.MyField(), state.CurrentShape(), candidate.placement, state.NextShape(), 0, depth);
+
+			if (!best.found || score > best.score)
+			{
+				SetDecision(candidate.placement, score, best);
+			}
+		}
+		return best;
+	}
+
+	//Total the pieces after the placed one reach on the board it leaves, the next shape is -1 when it is not known
+	double PlayOut(const Field& field, const int shape, const Placement& placement, const int nextShape, const int ply, const int depth)
+	{
+		if (ply + 1 >= depth)
+		{
+			return 0.0;
+		}
+
+		auto& child = lookaheadFields_[ply];
+		*child = field;
+		child->ApplyPlacement(shape, placement.rotation, placement.x, placement.y);
+
+		if (nextShape >= 0)
+		{
+			return BestPlayOut(*child, nextShape, ply + 1, depth);
+		}
+
+		//Every shape is as likely to come
+		auto total = 0.0;
+		for (auto unknown = 0; unknown < PieceTable::kShapeCount; unknown++)
+		{
+			total += BestPlayOut(*child, unknown, ply + 1, depth);
+		}
+		return total / PieceTable::kShapeCount;
+	}
+
+	//Best score of the shape and the pieces after it over its kBeamWidth best placements, only the best one on the last ply
+	double BestPlayOut(Field& field, const int shape, const int ply, const int depth)
+	{
+		ScoredPlacement scored[BitBoard::kMaxPlacements];
+		const auto count = ScanPlacements(field, shape, scored);
+		nodes_ += count;
+
+		int beam[kBeamWidth];
+		const auto width = BestPlacements(scored, count, beam, ply + 1 < depth ? kBeamWidth : 1);
+
+		//A topped out board scores like no decision at all
+		auto best = Decision().score;
+		for (auto i = 0; i < width; i++)
+		{
+			const auto& candidate = scored[beam[i]];
+			best = max(best, candidate.score + PlayOut(field, shape, candidate.placement, -1, ply, depth));
+		}
+		return best;
+	}
+
+	//Tree search with the time of the action, not found when it has no placement
+	Decision SearchMcts(BotState& state, const TimeManager::Clock::time_point deadline)
+	{
+		const auto result = mcts_.Search(state.MyField().Board(), state.CurrentShape(), state.NextShape(), state.Round(), deadline);
+
+		Decision best;
+		if (result.valid)
+		{
+			best.rotation = result.rotation;
+			best.xPosition = result.xPosition;
+			best.yPosition = result.yPosition;
+			best.score = 0.0;
+			best.found = true;
+		}
+		nodes_ += result.playouts;
+		stats_[SearchStrategies::MCTS].reused += result.reusedTree ? 1 : 0;
+		return best;
+	}
+
+	//Indices of the width best placements, best first, equal scores in reverse scan order like in the rankings
+	static int BestPlacements(const ScoredPlacement* scored, const int count, int* best, const int width)
+	{
+		auto kept = 0;
+		for (auto i = 0; i < count; i++)
+		{
+			if (kept == width && scored[i].score < scored[best[width - 1]].score)
+			{
+				continue;
+			}
+
+			auto slot = kept < width ? kept++ : width - 1;
+			for (; slot > 0 && scored[i].score >= scored[best[slot - 1]].score; slot--)
+			{
+				best[slot] = best[slot - 1];
+			}
+			best[slot] = i;
+		}
+		return kept;
+	}
+
+	static void SetDecision(const Placement& placement, const double score, Decision& decision)
+	{
+		decision.rotation = placement.rotation;
+		decision.xPosition = placement.x;
+		decision.yPosition = placement.y;
+		decision.score = score;
+		decision.found = true;
+	}
+
+	//Scores every rotation and column of the shape at the row it lands on, in rotation then column order
+	int ScanPlacements(Field& field, const int shape, ScoredPlacement* scored)
+	{
+		if (neuralEvaluator_ != nullptr)
+		{
+			return ScanPlacementsNeural(field, shape, scored);
+		}
+
+		if (ensembleEvaluator_ != nullptr)
+		{
+			return ScanPlacementsEnsemble(field, shape, scored);
+		}
+
+		if (composedEvaluator_ != nullptr)
+		{
+			return ScanPlacementsComposed(field, shape, scored);
+		}
+
+		if (placementEvaluator_ != nullptr)
+		{
+			return ScanPlacementsFeatures(field, shape, scored);
+		}
+
+		if (prune_)
+		{
+			return ScanPlacementsPruned(field, shape, scored);
+		}
+
+		return ScanPlacementsField(field, shape, scored);
+	}
+
+	//The field's own score for every placement
+	int ScanPlacementsField(Field& field, const int shape, ScoredPlacement* scored)
+	{
+		auto count = 0;
+
+		for (auto rotation = 0; rotation < PieceTable::RotationCount(shape); rotation++)
+		{
+			for (auto xPosition = 0; xPosition < field.width(); xPosition++)
+			{
+				const auto yPosition = field.LandingRow(shape, rotation, xPosition);
+
+				if (yPosition < 0)
 				{
-					double moveScore = 0.0f;
+					continue;
+				}
 
-					//Checks if position is valid for the shape and is accessible
-					if (state.MyField().CheckValidShapePosition(state.NextShape(), rotation, xPosition, yPosition, moveScore))
-					{
-						//We'll just insert a max of the five best possible moves, we ignore moves that produce the same score
-						pieceTwoAllPossibleMoves.insert(pieceTwoAllPossibleMoves.begin(), make_pair(moveScore, make_tuple(rotation, make_pair(xPosition, yPosition))));
+				scored[count].score = static_cast<float>(field.ScorePlacement(shape, rotation, xPosition, yPosition));
+				scored[count].placement = Placement{ static_cast<int8_t>(rotation), static_cast<int8_t>(xPosition), static_cast<int8_t>(yPosition) };
+				count++;
+			}
+		}
 
-						//cerr << "Possible position with rotation " << rotation << " at position x" << xPosition << " y" << yPosition << endl << endl;
-						break;
-					}
+		return count;
+	}
+
+	/**
+	 * The field's own scan, best bound first. Only the kLookAhead best
+	 * placements reach the pair search, so the scan pulls that many from a
+	 * stream and the placements whose bound stays below them are never
+	 * scored. The scored ones are written in scan order, so equal scores
+	 * rank as before.
+	 */
+	int ScanPlacementsPruned(Field& field, const int shape, ScoredPlacement* scored)
+	{
+		PlacementStream stream;
+		stream.Open(field, shape);
+
+		ScoredPlacement placement;
+		for (auto rank = 0; rank < kLookAhead && stream.Get(rank, placement); rank++)
+		{
+		}
+
+		placementsTotal_ += stream.BoundedCount();
+		placementsScored_ += stream.ScoredCount();
+
+		return stream.ScoredInScanOrder(scored);
+	}
+
+	//The field's own scores are pulled lazily with pruning, every other scan is scored up front
+	void StreamPlacements(Field& field, const int shape, PlacementStream& stream)
+	{
+		if (prune_ && neuralEvaluator_ == nullptr && ensembleEvaluator_ == nullptr && composedEvaluator_ == nullptr && placementEvaluator_ == nullptr)
+		{
+			stream.Open(field, shape);
+			return;
+		}
+
+		ScoredPlacement scored[BitBoard::kMaxPlacements];
+		const auto count = ScanPlacements(field, shape, scored);
+		nodes_ += count;
+		stream.Assign(scored, count);
+	}
+
+	//Same scan, but all resulting boards are scored by the network in one batch
+	int ScanPlacementsNeural(Field& field, const int shape, ScoredPlacement* scored)
+	{
+		Placement placements[BitBoard::kMaxPlacements];
+		BitBoard boards[BitBoard::kMaxPlacements];
+		double scores[BitBoard::kMaxPlacements];
+
+		const auto count = field.Board().Placements(shape, placements);
+
+		for (auto i = 0; i < count; i++)
+		{
+			boards[i] = field.Board();
+			boards[i].Place(shape, placements[i].rotation, placements[i].x, placements[i].y);
+		}
+
+		neuralEvaluator_->EvaluateBatch(boards, count, scores);
+
+		for (auto i = 0; i < count; i++)
+		{
+			scored[i].score = static_cast<float>(scores[i]);
+			scored[i].placement = placements[i];
+		}
+
+		return count;
+	}
+
+	//Same scan, the field's features of every placement weighed by all sets of the ensemble in one pass
+	int ScanPlacementsEnsemble(Field& field, const int shape, ScoredPlacement* scored)
+	{
+		Field::MoveFeatures features[BitBoard::kMaxPlacements];
+		double scores[BitBoard::kMaxPlacements];
+		auto count = 0;
+
+		for (auto rotation = 0; rotation < PieceTable::RotationCount(shape); rotation++)
+		{
+			for (auto xPosition = 0; xPosition < field.width(); xPosition++)
+			{
+				const auto yPosition = field.LandingRow(shape, rotation, xPosition);
+
+				if (yPosition < 0)
+				{
+					continue;
 				}
+
+				field.PlacementFeatures(shape, rotation, xPosition, yPosition, features[count]);
+				scored[count].placement = Placement{ static_cast<int8_t>(rotation), static_cast<int8_t>(xPosition), static_cast<int8_t>(yPosition) };
+				count++;
 			}
 		}
 
+		ensembleEvaluator_->EvaluateBatch(features, count, scores);
+
+		for (auto i = 0; i < count; i++)
+		{
+			scored[i].score = static_cast<float>(scores[i]);
+		}
+
+		return count;
+	}
+
+	//Same scan, with the resulting boards scored by the preset chosen with --evaluator
+	int ScanPlacementsComposed(Field& field, const int shape, ScoredPlacement* scored)
+	{
+		Placement placements[BitBoard::kMaxPlacements];
+		const auto count = field.Board().Placements(shape, placements);
+
+		for (auto i = 0; i < count; i++)
+		{
+			auto board = field.Board();
+			board.Place(shape, placements[i].rotation, placements[i].x, placements[i].y);
+
+			scored[i].score = static_cast<float>(composedEvaluator_(board));
+			scored[i].placement = placements[i];
+		}
+
+		return count;
+	}
+
+	//Same scan, each placement scored from its extended features on the board before it
+	int ScanPlacementsFeatures(Field& field, const int shape, ScoredPlacement* scored)
+	{
+		Placement placements[BitBoard::kMaxPlacements];
+		const auto count = field.Board().Placements(shape, placements);
+
+		for (auto i = 0; i < count; i++)
+		{
+			scored[i].score = static_cast<float>(placementEvaluator_(field.Board(), shape, placements[i]));
+			scored[i].placement = placements[i];
+		}
+
+		return count;
+	}
+
+	//Best combination of the ranked scan and the stream of the next piece without a collision between the pieces, gives up on the deadline
+	//With pruning both loops stop once the bounds, best first, cannot beat the best pair any more, before the next piece is scored
+	Decision PairSearch(const int currentShape, const int nextShape, const MoveRanking& pieceOne, PlacementStream& pieceTwo,
+		const TimeManager::Clock::time_point deadline)
+	{
 		auto secondPieceCount = 0;
 		auto firstPieceCount = 0;
-		const auto lookAheadLimitFirst = 10;
-		const auto lookAheadLimitSecond = 10;
+		const auto lookAheadLimitFirst = kLookAhead;
+		const auto lookAheadLimitSecond = kLookAhead;
+
+		pairsTotal_ += min<long long>(pieceOne.size(), lookAheadLimitFirst) * min<long long>(pieceTwo.Count(), lookAheadLimitSecond);
 
 		auto bestCombinationFirst = 0;
 		auto bestCombinationSecond = 0;
-		auto bestTotalScoreCombination = -10000000.0;
+		Decision best;
 
-		auto bestRotation = 0;
-		auto bestXPosition = 0;
-		auto bestYPosition = 0;
+		//Overlaps of the pieces are tested on footprints, a row of them for every first piece reached
+		PairCollisions collisions;
+		collisions.SetSecond(nextShape, pieceTwo.Placements(), pieceTwo.Count());
 
 		//Iterative though all possible moves for both pieces and find the best move to make with the first piece in mind
 		//(i.e. Best combination of score without a collision between the pieces)
-		for (auto firstPiece = pieceOneAllPossibleMoves.begin(); firstPiece != pieceOneAllPossibleMoves.end() && firstPieceCount < lookAheadLimitFirst; ++firstPiece)
+		for (auto firstPiece = pieceOne.begin(); firstPiece != pieceOne.end() && firstPieceCount < lookAheadLimitFirst; ++firstPiece)
 		{
-			secondPieceCount = 0;
+			//Keep the best combination found so far once the time budget is spent
+			if (firstPieceCount > 0 && TimeManager::Clock::now() >= deadline)
+			{
+				break;
+			}
+
+			//Neither this first piece nor a later, lower one beats the best pair even with the best second piece
+			if (prune_ && !(firstPiece->first + pieceTwo.Bound(0) > best.score))
+			{
+				break;
+			}
+
+			const auto first = Placement{ static_cast<int8_t>(std::get<0>(firstPiece->second)), static_cast<int8_t>(std::get<1>(firstPiece->second).first),
+				static_cast<int8_t>(std::get<1>(firstPiece->second).second) };
+			const auto overlaps = collisions.Row(currentShape, first);
 
-			for (auto secondPiece = pieceTwoAllPossibleMoves.begin(); secondPiece != pieceTwoAllPossibleMoves.end() && secondPieceCount < lookAheadLimitSecond; ++secondPiece)
+			for (secondPieceCount = 0; secondPieceCount < lookAheadLimitSecond; secondPieceCount++)
 			{
-				if (firstPiece->first + secondPiece->first > bestTotalScoreCombination)
+				//The bound covers the rounding of the float sum, this and every later second piece would not beat the best pair
+				if (prune_ && !(firstPiece->first + pieceTwo.Bound(secondPieceCount) > best.score))
+				{
+					break;
+				}
+
+				ScoredPlacement secondPiece;
+				if (!pieceTwo.Get(secondPieceCount, secondPiece))
 				{
-					int shapes[2] = { state.CurrentShape(), state.NextShape() };
-					int rotations[2] = { std::get<0>(firstPiece->second), std::get<0>(secondPiece->second) };
-					int xPositions[2] = { std::get<1>(firstPiece->second).first, std::get<1>(secondPiece->second).first };
-					int yPositions[2] = { std::get<1>(firstPiece->second).second, std::get<1>(secondPiece->second).second };
+					break;
+				}
 
+				pairsVisited_++;
+				nodes_++;
+
+				if (firstPiece->first + secondPiece.score > best.score)
+				{
 					//Check for a collision
-					if (!state.MyField().CheckTwoPieceCollision(shapes, rotations, xPositions, yPositions))
+					if ((overlaps >> pieceTwo.ScanIndex(secondPieceCount) & 1) == 0)
 					{
 						bestCombinationFirst = firstPieceCount;
 						bestCombinationSecond = secondPieceCount;
 
-						bestTotalScoreCombination = firstPiece->first + secondPiece->first;
+						best.score = firstPiece->first + secondPiece.score;
+						best.found = true;
 
-						bestRotation = std::get<0>(firstPiece->second);
-						bestXPosition = std::get<1>(firstPiece->second).first;
-						bestYPosition = std::get<1>(firstPiece->second).second;
+						best.rotation = first.rotation;
+						best.xPosition = first.x;
+						best.yPosition = first.y;
 					}
 				}
-
-				secondPieceCount++;
+				else if (prune_)
+				{
+					break;
+				}
 			}
 
 			firstPieceCount++;
 		}
 
+		placementsTotal_ += pieceTwo.BoundedCount();
+		placementsScored_ += pieceTwo.ScoredCount();
+		nodes_ += pieceTwo.ScoredCount();
+
 		//cerr << "Best Move Combination: " << "CurrentPiece " << bestCombinationFirst << " and SecondPiece " << bestCombinationSecond << endl;
-		//cerr << "Rotation: " << bestRotation << " XPosition: " << bestXPosition << " YPosition: " << bestYPosition << endl;
+		//cerr << "Rotation: " << best.rotation << " XPosition: " << best.xPosition << " YPosition: " << best.yPosition << endl;
 
-		//Add translation to moveset
-		auto xCurrentPosition = state.ShapeLocation().first;
-		auto yCurrentPosition = state.ShapeLocation().second;
+		return best;
+	}
 
-		//cerr << "CurrentXPosition: " << xCurrentPosition << " CurrentYPosition: " << yCurrentPosition << endl;
+	//Best first, the begin() hint puts equal scores in reverse scan order
+	static void Rank(const ScoredPlacement* scored, const int count, MoveRanking& possibleMoves)
+	{
+		for (auto i = 0; i < count; i++)
+		{
+			const Placement& placement = scored[i].placement;
+			possibleMoves.insert(possibleMoves.begin(), make_pair(scored[i].score, make_tuple(static_cast<int>(placement.rotation), make_pair(static_cast<int>(placement.x), static_cast<int>(placement.y)))));
+		}
+	}
 
-		CorrectCurrentPosition(state.CurrentShape(), bestRotation, xCurrentPosition, yCurrentPosition);
+	//Builds the moves for the chosen placement, records the decision and closes the search
+	const vector<Move::MoveType>& FinishMove(BotState& state, const int rotation, const int xPosition, const float score)
+	{
+		BuildMoveSet(state, rotation, xPosition);
 
-		//cerr << "AdjustedXPosition: " << xCurrentPosition << " AdjustedYPosition: " << yCurrentPosition << endl;
+		const Field& field = state.MyField();
+		const auto yPosition = field.LandingRow(state.CurrentShape(), rotation, xPosition);
+		decision_ = Placement{ static_cast<int8_t>(rotation), static_cast<int8_t>(xPosition), static_cast<int8_t>(yPosition) };
+		decided_ = yPosition >= 0;
 
-		//Add rotations to moveset
-		for (auto i = 0; i < bestRotation; i++)
+		if (recorder_ != nullptr)
 		{
-			bestMoveSet.emplace_back(Move::MoveType::TURNRIGHT);
+			recorder_->Record(field.Board(), state.Round(), state.CurrentShape(), state.NextShape(),
+				rotation, xPosition, yPosition, score);
 		}
 
-		if (xCurrentPosition < bestXPosition)
+		if (profiler_ != nullptr)
 		{
-			while (xCurrentPosition != bestXPosition)
-			{
-				bestMoveSet.emplace_back(Move::MoveType::RIGHT);
-				xCurrentPosition++;
-			}
+			profiler_->EndAction();
 		}
 
-		if (xCurrentPosition > bestXPosition)
+		timeManager_.FinishSearch();
+		return moveSet_;
+	}
+
+	//Starts counting the given phase, ending the one before
+	void Profile(const PhaseProfiler::Phase phase)
+	{
+		if (profiler_ != nullptr)
 		{
-			while (xCurrentPosition != bestXPosition)
-			{
-				bestMoveSet.emplace_back(Move::MoveType::LEFT);
-				xCurrentPosition--;
-			}
+			profiler_->Enter(phase);
 		}
+	}
 
-		bestMoveSet.emplace_back(Move::MoveType::DROP);
-
-		//Calculate move set
-
-		return bestMoveSet;
+	//Builds the moves for the current piece into the reserved move set
+	void BuildMoveSet(BotState& state, const int bestRotation, const int bestXPosition)
+	{
+		Move::MoveType moves[kMaxMoveSet];
+		moveSet_.assign(moves, moves + BuildMoves(state.CurrentShape(), bestRotation, state.ShapeLocation(), bestXPosition, moves));
 	}
 
-private:
-	void CorrectCurrentPosition(const int shape, const int rotation, int &currentXPosition, int &currentYPosition)
+	static void CorrectCurrentPosition(const int shape, const int rotation, int &currentXPosition, int &currentYPosition)
 	{
 		switch (shape)
 		{
@@ -309,6 +1000,47 @@ private:
 			break;
 		}
 	}
+
+	TimeManager timeManager_;
+	PatternCache* patternCache_ = nullptr;
+	const NeuralEvaluator* neuralEvaluator_ = nullptr;
+	const EnsembleEvaluator* ensembleEvaluator_ = nullptr;
+	EvaluatorRegistry::EvaluateFunction composedEvaluator_ = nullptr;
+	EvaluatorRegistry::PlacementFunction placementEvaluator_ = nullptr;
+	GameRecorder* recorder_ = nullptr;
+	PhaseProfiler* profiler_ = nullptr;
+
+	//Placement of the last decision and the scan of the next piece on the board it leads to
+	Placement decision_;
+	bool decided_ = false;
+	unique_ptr<Field> predictedField_;
+	struct {
+		BitBoard board;
+		int shape = -1;
+		int count = 0;
+		ScoredPlacement scored[BitBoard::kMaxPlacements];
+	} pondered_;
+	long long reuseHits_ = 0;
+	long long reuseMisses_ = 0;
+	ActionArena arena_;
+	vector<Move::MoveType> moveSet_;
+	int strategy_;
+	//Placements scored and pairs tried in the action, the playouts for the tree search
+	long long nodes_ = 0;
+	SearchStrategies::Stats stats_[SearchStrategies::COUNT];
+	//Boards the lookahead plays placements out on, one per ply
+	unique_ptr<Field> lookaheadFields_[kMaxDepth - 1];
+	bool ponder_;
+	bool prune_;
+	bool extend_;
+	long long placementsTotal_ = 0;
+	long long placementsScored_ = 0;
+	long long pairsTotal_ = 0;
+	long long pairsVisited_ = 0;
+	//Without a node pool games asking for the tree search get strategy_, refused is only logged once
+	bool mctsEnabled_;
+	bool mctsRefused_ = false;
+	MctsEngine mcts_;
 };
 
 #endif  //__BOT_STARTER_H
@@ -4,6 +4,7 @@
 #ifndef __BOT_STATE_H
 #define __BOT_STATE_H
 
+#include <cstdlib>
 #include <iostream>
 #include <map>
 #include <memory>
@@ -12,6 +13,7 @@
 
 #include "util.h"
 #include "player.h"
+#include "search-strategy.h"
 #include "shape.h"
 
 using namespace std;
@@ -23,9 +25,10 @@ typedef pair<int, int> Point;
  */
 class BotState {
 public:
-	BotState() { round_ = 0; }
+	BotState()
+		: round_(0), timebank_(10000), max_timebank_(10000), time_per_move_(500), field_width_(0), field_height_(0), search_strategy_(-1) {}
 
-	void UpdateSettings(string key, string value) {
+	void UpdateSettings(const string& key, const string& value) {
 		if (key == "timebank") {
 			max_timebank_ = stoi(value);
 			timebank_ = max_timebank_;
@@ -48,12 +51,16 @@ public:
 		else if (key == "field_height") {
 			field_height_ = stoi(value);
 		}
+		else if (key == "strategy") {
+			search_strategy_ = SearchStrategies::Find(value);
+		}
 		else {
 			cerr << "Cannot parse settings with key: " << key << endl;
 		}
 	}
 
-	void UpdateState(string player, string key, string value) {
+	// Called for every line of every round, so it reuses the fields and builds no strings.
+	void UpdateState(const string& player, const string& key, const string& value) {
 		if (key == "round") {
 			round_ = stoi(value);
 		}
@@ -70,12 +77,18 @@ public:
 			players_[player]->set_combo(stoi(value));
 		}
 		else if (key == "field") {
-			players_[player]->set_field(
-				unique_ptr<Field>(new Field(field_width_, field_height_, value)));
+			Player& owner = *players_[player];
+			if (owner.has_field() && owner.field().width() == field_width_ && owner.field().height() == field_height_) {
+				owner.field().Load(value);
+			}
+			else {
+				owner.set_field(unique_ptr<Field>(new Field(field_width_, field_height_, value)));
+			}
 		}
 		else if (key == "this_piece_position") {
-			vector<string> split_value = Split(value, ',');
-			shape_location_ = make_pair(stoi(split_value[0]), stoi(split_value[1]));
+			char* separator = nullptr;
+			const int x = static_cast<int>(strtol(value.c_str(), &separator, 10));
+			shape_location_ = make_pair(x, static_cast<int>(strtol(separator + 1, nullptr, 10)));
 		}
 		else {
 			cerr << "Cannot parse updates with key: " << key << endl;
@@ -104,6 +117,23 @@ public:
 
 	int Round() const { return round_; }
 
+	int Timebank() const { return timebank_; }
+
+	// The engine reports the remaining timebank with every action.
+	void set_timebank(int timebank) { timebank_ = timebank; }
+
+	int MaxTimebank() const { return max_timebank_; }
+
+	int TimePerMove() const { return time_per_move_; }
+
+	// 0 until the field_width setting arrived, like FieldHeight.
+	int FieldWidth() const { return field_width_; }
+
+	int FieldHeight() const { return field_height_; }
+
+	// SearchStrategies::Kind the game asked for with a setting, -1 for the one of the bot.
+	int SearchStrategy() const { return search_strategy_; }
+
 private:
 	int round_;
 	int timebank_;
@@ -117,6 +147,7 @@ private:
 	int time_per_move_;
 	int field_width_;
 	int field_height_;
+	int search_strategy_;
 };
 
 #endif  //__BOT_STATE_H
@@ -0,0 +1,288 @@
+#ifndef __COMPOSED_EVALUATOR_H
+#define __COMPOSED_EVALUATOR_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#include "bit-board.h"
+#include "board-features.h"
+#include "mask-tables.h"
+
+using namespace std;
+
+/**
+ * Board evaluators put together at compile time from feature policies.
+ * Every feature carries its weight as a template parameter in millionths
+ * and hooks into one shared pass over the rows and one over the columns.
+ * ComposedEvaluator<...> runs each pass only if some feature needs it and
+ * skips zero-weight features entirely, so trying a feature set costs
+ * nothing once it is compiled into a preset.
+ */
+namespace features {
+
+// What a row hook sees: the row, everything above it and where it is.
+struct RowScan {
+	uint32_t row;
+	uint32_t covered;
+	uint32_t full;
+	int y;
+	int width;
+	bool playable;
+};
+
+// What a column hook sees, walls count as infinitely high neighbours.
+struct ColumnScan {
+	const BitBoard* board;
+	int x;
+	int height;
+	int leftHeight;
+	int rightHeight;
+	bool hasLeft;
+};
+
+struct NoRows {
+	static const bool kRows = false;
+	template <class Accumulator>
+	static void Row(Accumulator&, const RowScan&) {}
+};
+
+struct NoColumns {
+	static const bool kColumns = false;
+	template <class Accumulator>
+	static void Column(Accumulator&, const ColumnScan&) {}
+};
+
+template <int WeightMicros>
+struct Weighted {
+	static constexpr double kWeight = WeightMicros / 1000000.0;
+	typedef int Accumulator;
+};
+
+template <int WeightMicros>
+struct SumOfHeights : Weighted<WeightMicros>, NoRows {
+	static const bool kColumns = true;
+	static void Column(int& sum, const ColumnScan& scan) { sum += scan.height; }
+};
+
+template <int WeightMicros>
+struct CompletedLines : Weighted<WeightMicros>, NoColumns {
+	static const bool kRows = true;
+	static void Row(int& lines, const RowScan& scan) { lines += scan.playable && scan.row == scan.full ? 1 : 0; }
+};
+
+// Empty cells with an occupied cell anywhere above them.
+template <int WeightMicros>
+struct Holes : Weighted<WeightMicros>, NoColumns {
+	static const bool kRows = true;
+	static void Row(int& holes, const RowScan& scan) { holes += PopCount(scan.covered & ~scan.row & scan.full); }
+};
+
+template <int WeightMicros>
+struct Roughness : Weighted<WeightMicros>, NoRows {
+	static const bool kColumns = true;
+	static void Column(int& roughness, const ColumnScan& scan) { roughness += scan.hasLeft ? abs(scan.height - scan.leftHeight) : 0; }
+};
+
+// Cumulative wells: a well of depth d counts 1 + 2 + ... + d.
+template <int WeightMicros>
+struct Wells : Weighted<WeightMicros>, NoRows {
+	static const bool kColumns = true;
+	static void Column(int& wells, const ColumnScan& scan)
+	{
+		const auto depth = min(scan.leftHeight, scan.rightHeight) - scan.height;
+		wells += depth > 0 ? depth * (depth + 1) / 2 : 0;
+	}
+};
+
+// Occupied cells above each hole in its column, summed over the holes, from the column table.
+template <int WeightMicros>
+struct HoleDepth : Weighted<WeightMicros>, NoRows {
+	static const bool kColumns = true;
+	static void Column(int& depth, const ColumnScan& scan)
+	{
+		depth += MaskTables::Column(scan.board->ColumnMask(scan.x), scan.board->height()).holeDepth;
+	}
+};
+
+// Filled/empty changes along each row, the side walls count as filled.
+template <int WeightMicros>
+struct RowTransitions : Weighted<WeightMicros>, NoColumns {
+	static const bool kRows = true;
+	static void Row(int& transitions, const RowScan& scan) { transitions += MaskTables::Row(scan.row, scan.width).transitions; }
+};
+
+}  // namespace features
+
+template <class... Features>
+class ComposedEvaluator {
+public:
+	static double Evaluate(const BitBoard& board)
+	{
+		tuple<typename Features::Accumulator...> accumulators;
+		Scan(board, accumulators, index_sequence_for<Features...>());
+		return Combine(accumulators, index_sequence_for<Features...>());
+	}
+
+private:
+	static constexpr bool AnyRows() { return Any({ (Features::kRows && Features::kWeight != 0.0)... }); }
+
+	static constexpr bool AnyColumns() { return Any({ (Features::kColumns && Features::kWeight != 0.0)... }); }
+
+	static constexpr bool Any(initializer_list<bool> flags)
+	{
+		for (const bool flag : flags)
+		{
+			if (flag)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	template <class Accumulators, size_t... Index>
+	static void Scan(const BitBoard& board, Accumulators& accumulators, index_sequence<Index...>)
+	{
+		int unused[] = { (get<Index>(accumulators) = typename Features::Accumulator(), 0)..., 0 };
+		(void)unused;
+
+		if (AnyRows())
+		{
+			features::RowScan scan;
+			scan.covered = 0;
+			scan.full = board.FullRow();
+			scan.width = board.width();
+
+			for (auto y = 0; y < board.height(); y++)
+			{
+				scan.row = board.Row(y);
+				scan.y = y;
+				scan.playable = y < board.height() - board.SolidRows();
+
+				int hooks[] = { (Features::kWeight != 0.0 ? (Features::Row(get<Index>(accumulators), scan), 0) : 0)..., 0 };
+				(void)hooks;
+
+				scan.covered |= scan.row;
+			}
+		}
+
+		if (AnyColumns())
+		{
+			const auto wall = board.height() + 1;
+			features::ColumnScan scan;
+			scan.board = &board;
+			scan.leftHeight = wall;
+			scan.height = board.ColumnHeight(0);
+
+			for (auto x = 0; x < board.width(); x++)
+			{
+				scan.x = x;
+				scan.hasLeft = x > 0;
+				scan.rightHeight = x + 1 < board.width() ? board.ColumnHeight(x + 1) : wall;
+
+				int hooks[] = { (Features::kWeight != 0.0 ? (Features::Column(get<Index>(accumulators), scan), 0) : 0)..., 0 };
+				(void)hooks;
+
+				scan.leftHeight = scan.height;
+				scan.height = scan.rightHeight;
+			}
+		}
+	}
+
+	template <class Accumulators, size_t... Index>
+	static double Combine(const Accumulators& accumulators, index_sequence<Index...>)
+	{
+		double total = 0.0;
+		int terms[] = { (total += Features::kWeight * get<Index>(accumulators), 0)..., 0 };
+		(void)terms;
+		return total;
+	}
+};
+
+/**
+ * Compiled presets selectable by name at startup.
+ * "classic" is the score Field::CalculateMoveScore had before it told
+ * sealed holes from overhangs, every hole weighs as a sealed one.
+ * "hole-depth" is classic with every hole also weighing by the cells
+ * stacked over it, so burying a hole deeper costs more.
+ * "el-tetris" needs the placement itself and is found with FindPlacement.
+ */
+class EvaluatorRegistry {
+public:
+	typedef double (*EvaluateFunction)(const BitBoard&);
+	typedef double (*PlacementFunction)(const BitBoard& board, int shape, const Placement& placement);
+
+	typedef ComposedEvaluator<
+		features::SumOfHeights<-510066>,
+		features::CompletedLines<760666>,
+		features::Holes<-356630>,
+		features::Roughness<-184483>> Classic;
+
+	typedef ComposedEvaluator<
+		features::SumOfHeights<-510066>,
+		features::CompletedLines<760666>,
+		features::Holes<-356630>,
+		features::Roughness<-184483>,
+		features::Wells<-120000>,
+		features::RowTransitions<-150000>> Extended;
+
+	typedef ComposedEvaluator<
+		features::SumOfHeights<-400000>,
+		features::Roughness<-250000>,
+		features::Wells<-200000>> Surface;
+
+	typedef ComposedEvaluator<
+		features::SumOfHeights<-510066>,
+		features::CompletedLines<760666>,
+		features::Holes<-356630>,
+		features::Roughness<-184483>,
+		features::HoleDepth<-60000>> HoleDepth;
+
+	// Returns nullptr and lists the presets when the name is unknown.
+	static EvaluateFunction Find(const string& name)
+	{
+		if (name == "classic")
+		{
+			return &Classic::Evaluate;
+		}
+		if (name == "extended")
+		{
+			return &Extended::Evaluate;
+		}
+		if (name == "surface")
+		{
+			return &Surface::Evaluate;
+		}
+		if (name == "hole-depth")
+		{
+			return &HoleDepth::Evaluate;
+		}
+
+		cerr << "Unknown evaluator " << name << ", available: classic, extended, surface, hole-depth, el-tetris" << endl;
+		return nullptr;
+	}
+
+	// Presets scoring the placement on the board before it, nullptr for the other names.
+	static PlacementFunction FindPlacement(const string& name)
+	{
+		if (name == "el-tetris")
+		{
+			return &ElTetris;
+		}
+		return nullptr;
+	}
+
+private:
+	static double ElTetris(const BitBoard& board, const int shape, const Placement& placement)
+	{
+		const FeatureWeights weights;
+		return ScoreFeatures(ExtractFeatures(board, shape, placement.rotation, placement.x, placement.y), weights);
+	}
+};
+
+#endif  // __COMPOSED_EVALUATOR_H
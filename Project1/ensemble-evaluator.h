@@ -0,0 +1,232 @@
+#ifndef __ENSEMBLE_EVALUATOR_H
+#define __ENSEMBLE_EVALUATOR_H
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "field.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ENSEMBLE_AVX __attribute__((target("avx")))
+#define ENSEMBLE_HAS_AVX 1
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#define ENSEMBLE_AVX
+#define ENSEMBLE_HAS_AVX 1
+#else
+#define ENSEMBLE_HAS_AVX 0
+#endif
+
+using namespace std;
+
+/**
+ * Several weight sets for the features of Field::CalculateMoveScore,
+ * scoring every placement under all of them. The features are counted
+ * once per placement and the sets are laid out feature by feature, so one
+ * pass of AVX multiplies and adds weighs them for all sets side by side,
+ * four sets a register, and the scalar path adds in the same order.
+ * Weights come from a text file with one set per line:
+ *   sumOfHeights completedLines blockedHoleCount overhangHoleCount surfaceRoughness
+ * empty lines and lines starting with '#' are skipped. The scores of a
+ * placement are combined by averaging them, or by a vote: the placement
+ * gets the best score a majority of the sets give it at least, so a set
+ * that is alone in liking or hating a board does not move it.
+ */
+class EnsembleEvaluator {
+public:
+	static const int kFeatures = 5;
+	static const int kMaxSets = 8;
+
+	enum Combine {
+		AVERAGE,
+		VOTE
+	};
+
+	bool Load(const string& path, const string& combine)
+	{
+		if (combine == "average")
+		{
+			combine_ = AVERAGE;
+		}
+		else if (combine == "vote")
+		{
+			combine_ = VOTE;
+		}
+		else
+		{
+			cerr << "Unknown ensemble combination " << combine << ", available: average, vote" << endl;
+			return false;
+		}
+
+		ifstream in(path);
+		if (!in)
+		{
+			cerr << "Unable to open weight sets " << path << endl;
+			return false;
+		}
+
+		setCount_ = 0;
+		for (auto& feature : weights_)
+		{
+			fill(feature, feature + kMaxSets, 0.0);
+		}
+
+		string line;
+		auto lineNumber = 0;
+		while (getline(in, line))
+		{
+			lineNumber++;
+			const auto start = line.find_first_not_of(" \t\r");
+			if (start == string::npos || line[start] == '#')
+			{
+				continue;
+			}
+
+			if (setCount_ == kMaxSets)
+			{
+				cerr << "More than " << kMaxSets << " weight sets in " << path << endl;
+				return false;
+			}
+
+			istringstream values(line);
+			for (auto feature = 0; feature < kFeatures; feature++)
+			{
+				if (!(values >> weights_[feature][setCount_]))
+				{
+					cerr << "Line " << lineNumber << " of " << path << " needs " << kFeatures << " weights" << endl;
+					return false;
+				}
+			}
+			setCount_++;
+		}
+
+		if (setCount_ == 0)
+		{
+			cerr << "No weight sets in " << path << endl;
+			return false;
+		}
+
+		loaded_ = true;
+		useAvx_ = CpuHasAvx();
+		return true;
+	}
+
+	bool IsLoaded() const { return loaded_; }
+
+	int SetCount() const { return setCount_; }
+
+	bool UsesAvx() const { return useAvx_; }
+
+	void ForceScalar() { useAvx_ = false; }
+
+	// Scores count placements from their features into scores, higher is better like CalculateMoveScore.
+	void EvaluateBatch(const Field::MoveFeatures* features, const int count, double* scores) const
+	{
+		alignas(32) double sets[kMaxSets];
+
+		for (auto i = 0; i < count; i++)
+		{
+#if ENSEMBLE_HAS_AVX
+			if (useAvx_)
+			{
+				ScoreSetsAvx(features[i], sets);
+			}
+			else
+#endif
+			{
+				ScoreSets(features[i], sets);
+			}
+
+			scores[i] = CombineSets(sets);
+		}
+	}
+
+private:
+	// One score per set, the sets past setCount_ have zero weights and score 0.
+	void ScoreSets(const Field::MoveFeatures& features, double* sets) const
+	{
+		const double values[kFeatures] = { static_cast<double>(features.sumOfHeights), static_cast<double>(features.completedLines),
+			static_cast<double>(features.sealedHoles), static_cast<double>(features.overhangs), static_cast<double>(features.surfaceRoughness) };
+
+		for (auto set = 0; set < kMaxSets; set++)
+		{
+			sets[set] = 0.0;
+		}
+
+		for (auto feature = 0; feature < kFeatures; feature++)
+		{
+			for (auto set = 0; set < kMaxSets; set++)
+			{
+				sets[set] += weights_[feature][set] * values[feature];
+			}
+		}
+	}
+
+	double CombineSets(double* sets) const
+	{
+		if (combine_ == VOTE)
+		{
+			//The score at index setCount_ / 2 of the best first order is given by more than half of the sets
+			const auto majority = setCount_ / 2;
+			nth_element(sets, sets + majority, sets + setCount_, greater<double>());
+			return sets[majority];
+		}
+
+		auto total = 0.0;
+		for (auto set = 0; set < setCount_; set++)
+		{
+			total += sets[set];
+		}
+		return total / setCount_;
+	}
+
+#if ENSEMBLE_HAS_AVX
+	// ScoreSets with the eight sets in two registers.
+	ENSEMBLE_AVX void ScoreSetsAvx(const Field::MoveFeatures& features, double* sets) const
+	{
+		const int values[kFeatures] = { features.sumOfHeights, features.completedLines, features.sealedHoles, features.overhangs,
+			features.surfaceRoughness };
+
+		__m256d low = _mm256_setzero_pd();
+		__m256d high = _mm256_setzero_pd();
+
+		for (auto feature = 0; feature < kFeatures; feature++)
+		{
+			const __m256d value = _mm256_set1_pd(static_cast<double>(values[feature]));
+			low = _mm256_add_pd(low, _mm256_mul_pd(_mm256_load_pd(weights_[feature]), value));
+			high = _mm256_add_pd(high, _mm256_mul_pd(_mm256_load_pd(weights_[feature] + 4), value));
+		}
+
+		_mm256_store_pd(sets, low);
+		_mm256_store_pd(sets + 4, high);
+	}
+
+	static bool CpuHasAvx()
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 28)) != 0;
+#else
+		return __builtin_cpu_supports("avx") != 0;
+#endif
+	}
+#else
+	static bool CpuHasAvx() { return false; }
+#endif
+
+	// Weights feature by feature, the sets of one feature next to each other.
+	alignas(32) double weights_[kFeatures][kMaxSets] = {};
+	int setCount_ = 0;
+	Combine combine_ = AVERAGE;
+	bool loaded_ = false;
+	bool useAvx_ = false;
+};
+
+#endif  // __ENSEMBLE_EVALUATOR_H
@@ -0,0 +1,54 @@
+#ifndef __EVALUATION_H
+#define __EVALUATION_H
+
+#include <cstdlib>
+
+#include "bit-board.h"
+
+using namespace std;
+
+/**
+ * The weighted features of Field::CalculateMoveScore, computed on a
+ * BitBoard so searches can score boards without a Field.
+ */
+struct EvaluationWeights {
+	double sumOfHeights = -0.510066;
+	double completedLines = 0.760666;
+	double blockedHoleCount = -0.35663;
+	// Holes a piece can still slide into, see BitBoard::ClassifyHoles.
+	double overhangHoleCount = -0.25;
+	double surfaceRoughness = -0.184483;
+};
+
+inline double EvaluateBoard(const BitBoard& board, const EvaluationWeights& weights)
+{
+	auto sumOfHeights = 0;
+	auto surfaceRoughness = 0;
+	auto completedLines = 0;
+
+	auto previousHeight = board.ColumnHeight(0);
+	sumOfHeights += previousHeight;
+
+	for (auto x = 1; x < board.width(); x++)
+	{
+		const auto height = board.ColumnHeight(x);
+		sumOfHeights += height;
+		surfaceRoughness += abs(height - previousHeight);
+		previousHeight = height;
+	}
+
+	for (auto y = 0; y < board.height() - board.SolidRows(); y++)
+	{
+		if (board.Row(y) == board.FullRow())
+		{
+			completedLines++;
+		}
+	}
+
+	const auto holes = board.ClassifyHoles();
+
+	return weights.sumOfHeights * sumOfHeights + weights.completedLines * completedLines + weights.blockedHoleCount * holes.sealed +
+		weights.overhangHoleCount * holes.overhangs + weights.surfaceRoughness * surfaceRoughness;
+}
+
+#endif  // __EVALUATION_H
@@ -0,0 +1,97 @@
+#ifndef __FD_STREAM_H
+#define __FD_STREAM_H
+
+#ifndef _WIN32
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+
+using namespace std;
+
+/**
+ * Buffered stream over a POSIX file descriptor (socket or pipe),
+ * so BotParser can talk to it like it talks to cin/cout.
+ * A failed write, like EPIPE from a peer that went away, fails the
+ * output and ends the input too, so the game on it ends instead of
+ * waiting for commands nobody will answer.
+ */
+class FdStreamBuf : public streambuf {
+public:
+	explicit FdStreamBuf(int fd) : fd_(fd) {
+		setg(readBuffer_, readBuffer_, readBuffer_);
+		setp(writeBuffer_, writeBuffer_ + kBufferSize);
+	}
+
+	~FdStreamBuf() { sync(); }
+
+	int fd() const { return fd_; }
+
+protected:
+	int_type underflow() override {
+		if (broken_) {
+			return traits_type::eof();
+		}
+
+		ssize_t count;
+		do {
+			count = read(fd_, readBuffer_, kBufferSize);
+		} while (count < 0 && errno == EINTR);
+
+		if (count <= 0) {
+			return traits_type::eof();
+		}
+		setg(readBuffer_, readBuffer_, readBuffer_ + count);
+		return traits_type::to_int_type(*gptr());
+	}
+
+	int_type overflow(int_type c) override {
+		if (sync() != 0) {
+			return traits_type::eof();
+		}
+		if (!traits_type::eq_int_type(c, traits_type::eof())) {
+			*pptr() = traits_type::to_char_type(c);
+			pbump(1);
+		}
+		return traits_type::not_eof(c);
+	}
+
+	int sync() override {
+		if (broken_) {
+			setp(writeBuffer_, writeBuffer_ + kBufferSize);
+			return -1;
+		}
+
+		const char* data = pbase();
+		while (data < pptr()) {
+			const ssize_t written = write(fd_, data, pptr() - data);
+			if (written < 0 && errno == EINTR) {
+				continue;
+			}
+			if (written <= 0) {
+				// The rest of the output is dropped, a later sync fails right away.
+				broken_ = true;
+				setp(writeBuffer_, writeBuffer_ + kBufferSize);
+				return -1;
+			}
+			data += written;
+		}
+		setp(writeBuffer_, writeBuffer_ + kBufferSize);
+		return 0;
+	}
+
+private:
+	static const int kBufferSize = 4096;
+
+	int fd_;
+	bool broken_ = false;
+	char readBuffer_[kBufferSize];
+	char writeBuffer_[kBufferSize];
+};
+
+#endif  // _WIN32
+
+#endif  //__FD_STREAM_H
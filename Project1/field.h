@@ -4,11 +4,15 @@
 #ifndef __FIELD_H
 #define __FIELD_H
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
+#include <limits>
 #include <memory>
 #include <string>
+#include <vector>
 
+#include "bit-board.h"
 #include "cell.h"
 
 using namespace std;
@@ -21,7 +25,12 @@ class Field {
 public:
 	// Parses the input string to get a grid with Cell objects.
 	Field(int width, int height, const string& fieldStr)
-		: width_(width), height_(height), grid_(width * height) {
+		: width_(width), height_(height), grid_(width * height), board_(width, height) {
+		Load(fieldStr);
+	}
+
+	// Overwrites every cell from the input string, which must describe a field of this size.
+	void Load(const string& fieldStr) {
 		int x = 0;
 		int y = 0;
 		const char* strPos = fieldStr.c_str();
@@ -35,8 +44,8 @@ public:
 			strNext = nullptr;
 
 			// Update this cell.
-			grid_[y * width + x].SetLocation(x, y);
-			grid_[y * width + x].set_state(cellCode);
+			grid_[y * width_ + x].SetLocation(x, y);
+			SetCell(x, y, cellCode);
 
 			// Advance position, parse separator.
 			x++;
@@ -52,6 +61,29 @@ public:
 		}
 	}
 
+	// Field holding the cells of a board that did not come from the engine, solid rows included.
+	explicit Field(const BitBoard& board)
+		: width_(board.width()), height_(board.height()), grid_(width_ * height_), board_(width_, height_) {
+		Load(board);
+	}
+
+	// Overwrites every cell with the board, which must have the size of the field.
+	void Load(const BitBoard& board)
+	{
+		assert(board.width() == width_ && board.height() == height_);
+
+		for (auto y = 0; y < height_; y++)
+		{
+			const auto solid = y >= height_ - board.SolidRows();
+
+			for (auto x = 0; x < width_; x++)
+			{
+				grid_[y * width_ + x].SetLocation(x, y);
+				SetCell(x, y, solid ? Cell::SOLID : (board.IsOccupied(x, y) ? Cell::BLOCK : Cell::EMPTY));
+			}
+		}
+	}
+
 	int SolidRowCount() const
 	{
 		auto solidRowCount = 0;
@@ -68,6 +100,225 @@ public:
 		return solidRowCount;
 	}
 
+	int MaxColumnHeight() const
+	{
+		auto maxHeight = 0;
+
+		for (auto x = 0; x < width_; x++)
+		{
+			maxHeight = max(maxHeight, board_.ColumnHeight(x));
+		}
+
+		return maxHeight;
+	}
+
+	int ColumnHeight(const int x) const { return board_.ColumnHeight(x); }
+
+	int HoleCount() const { return board_.HoleCount(); }
+
+	//Row the shape lands on when dropped at xPosition, from the column skyline, -1 if it does not fit
+	int LandingRow(const int shape, const int rotation, const int xPosition) const
+	{
+		return board_.LandingRow(shape, rotation, xPosition);
+	}
+
+	//Places the shape as blocks, calculates the AI's score for the resulting grid and removes it again
+	double ScorePlacement(const int shape, const int rotation, const int xPosition, const int yPosition)
+	{
+		double moveScore = 0.0;
+		const auto& cells = PieceTable::Get(shape, rotation).cells;
+
+		for (auto& cell : cells)
+		{
+			SetCell(xPosition + cell.dx, yPosition + cell.dy, Cell::BLOCK);
+		}
+
+		CalculateMoveScore(moveScore);
+
+		for (auto& cell : cells)
+		{
+			SetCell(xPosition + cell.dx, yPosition + cell.dy, Cell::EMPTY);
+		}
+
+		return moveScore;
+	}
+
+	// The counts CalculateMoveScore weighs, in the order of its weights.
+	struct MoveFeatures {
+		int sumOfHeights = 0;
+		int completedLines = 0;
+		int sealedHoles = 0;
+		int overhangs = 0;
+		int surfaceRoughness = 0;
+	};
+
+	//Same as ScorePlacement, but hands out the counts instead of weighing them, for evaluators with their own weights
+	void PlacementFeatures(const int shape, const int rotation, const int xPosition, const int yPosition, MoveFeatures& features)
+	{
+		const auto& cells = PieceTable::Get(shape, rotation).cells;
+
+		for (auto& cell : cells)
+		{
+			SetCell(xPosition + cell.dx, yPosition + cell.dy, Cell::BLOCK);
+		}
+
+		CalculateMoveFeatures(features);
+
+		for (auto& cell : cells)
+		{
+			SetCell(xPosition + cell.dx, yPosition + cell.dy, Cell::EMPTY);
+		}
+	}
+
+	const BitBoard& Board() const { return board_; }
+
+	// The parts of CalculateMoveScore that stay the same for every placement on this field, see ScoreBound.
+	struct ScoreBase {
+		int heights[BitBoard::kMaxWidth];
+		int sumOfHeights;
+		BitBoard::HoleClasses holes;
+		int completedLines;
+		int playableRows;
+		// Cells CalculateMoveScore treats as filled in a row: blocks, solid and falling piece cells.
+		uint32_t filled[BitBoard::kMaxHeight];
+	};
+
+	void PrepareScoreBound(ScoreBase& base) const
+	{
+		base.sumOfHeights = 0;
+		for (auto x = 0; x < width_; x++)
+		{
+			base.heights[x] = board_.ColumnHeight(x);
+			base.sumOfHeights += base.heights[x];
+		}
+
+		//Falling piece cells under a block are not holes to CalculateMoveScore
+		base.holes = board_.ClassifyHoles(shapeRows_);
+		base.playableRows = height_ - board_.SolidRows();
+		base.completedLines = 0;
+
+		for (auto y = 0; y < height_; y++)
+		{
+			base.filled[y] = board_.Row(y) | shapeRows_[y];
+
+			if (y < base.playableRows && base.filled[y] == board_.FullRow())
+			{
+				base.completedLines++;
+			}
+		}
+	}
+
+	/**
+	 * What ScorePlacement returns for a straight drop, without touching the
+	 * grid: the heights follow from the skyline, the new holes are the gaps
+	 * under the piece and only the rows of the piece can complete. A drop
+	 * only fills cells open to the top, so holes keep their class or become
+	 * sealed and the gaps are at least overhangs, with sealed holes weighing
+	 * more the bound stays above the score. Returns
+	 * infinity when the piece overlaps cells of the falling piece, which
+	 * ScorePlacement overwrites, so the caller has to score it for real.
+	 */
+	double ScoreBound(const ScoreBase& base, const int shape, const int rotation, const int xPosition, const int yPosition) const
+	{
+		const auto& orientation = PieceTable::Get(shape, rotation);
+		uint32_t piece[4] = { 0, 0, 0, 0 };
+		int pieceTop[4] = { height_, height_, height_, height_ };
+
+		for (auto& cell : orientation.cells)
+		{
+			piece[-cell.dy] |= 1u << (xPosition + cell.dx);
+			pieceTop[cell.dx] = min(pieceTop[cell.dx], yPosition + cell.dy);
+		}
+
+		auto completedLines = base.completedLines;
+		for (auto k = 0; k < orientation.height; k++)
+		{
+			const auto y = yPosition - k;
+
+			if ((base.filled[y] & piece[k]) != 0)
+			{
+				return numeric_limits<double>::infinity();
+			}
+
+			if (y < base.playableRows && base.filled[y] != board_.FullRow() && (base.filled[y] | piece[k]) == board_.FullRow())
+			{
+				completedLines++;
+			}
+		}
+
+		int heights[BitBoard::kMaxWidth];
+		auto sumOfHeights = base.sumOfHeights;
+		auto overhangs = base.holes.overhangs;
+
+		for (auto x = 0; x < width_; x++)
+		{
+			heights[x] = base.heights[x];
+		}
+
+		for (auto dx = 0; dx < orientation.width; dx++)
+		{
+			const auto x = xPosition + dx;
+			const auto height = max(heights[x], height_ - pieceTop[dx]);
+
+			sumOfHeights += height - heights[x];
+			heights[x] = height;
+			overhangs += board_.ColumnTop(x) - 1 - (yPosition + orientation.bottom[dx]);
+		}
+
+		auto surfaceRoughness = 0;
+		for (auto x = 0; x + 1 < width_; x++)
+		{
+			surfaceRoughness += abs(heights[x] - heights[x + 1]);
+		}
+
+		return m_sumOfHeightsWeight * sumOfHeights + m_completedLinesWeight * completedLines + m_blockedHoleCountWeight * base.holes.sealed +
+			m_overhangHoleWeight * overhangs + m_surfaceRoughness * surfaceRoughness;
+	}
+
+	//Locks the shape as blocks and clears completed rows like the engine, the falling piece is removed first
+	void ApplyPlacement(const int shape, const int rotation, const int xPosition, const int yPosition)
+	{
+		for (auto& cell : grid_)
+		{
+			if (cell.IsShape())
+			{
+				SetCell(cell.x(), cell.y(), Cell::EMPTY);
+			}
+		}
+
+		for (auto& cell : PieceTable::Get(shape, rotation).cells)
+		{
+			SetCell(xPosition + cell.dx, yPosition + cell.dy, Cell::BLOCK);
+		}
+
+		//Rows above a cleared one move down, solid rows never clear
+		auto target = height_ - 1;
+		for (auto y = height_ - 1; y >= 0; y--)
+		{
+			if (board_.Row(y) == board_.FullRow() && !GetCell(0, y).IsSolid())
+			{
+				continue;
+			}
+
+			if (target != y)
+			{
+				for (auto x = 0; x < width_; x++)
+				{
+					SetCell(x, target, GetCell(x, y).state());
+				}
+			}
+			target--;
+		}
+
+		for (auto y = target; y >= 0; y--)
+		{
+			for (auto x = 0; x < width_; x++)
+			{
+				SetCell(x, y, Cell::EMPTY);
+			}
+		}
+	}
+
 	bool CheckValidShapePosition(const int &shape, const int &rotation, const int &xPosition, const int &yPosition, double &moveScore)
 	{
 		auto shapeFits = true;
@@ -255,11 +506,18 @@ public:
 			return false;
 		}
 
-		for (auto& cell : shapeCells)
+		//Every cell of the shape has to be one the flood fill from the top gets to
+		if (shapeFits)
 		{
-			if (!IsAccessible(cell))
+			uint32_t reachable[BitBoard::kMaxHeight];
+			board_.Reachable(reachable);
+
+			for (auto& cell : shapeCells)
 			{
-				shapeFits = false;
+				if (!IsAccessible(cell, reachable))
+				{
+					shapeFits = false;
+				}
 			}
 		}
 
@@ -284,233 +542,17 @@ public:
 		return shapeFits;
 	}
 
-	bool CheckTwoPieceCollision(const int shape[2], const int rotation[2], const int xPosition[2], const int yPosition[2])
+	//Empty and connected to the top through empty cells, see BitBoard::Reachable
+	bool IsAccessible(const Cell& c, const uint32_t* reachable) const
 	{
-		auto collision = false;
-		Cell shapeCells[8];
-
-		for(unsigned int i = 0; i < 8; i += 4)
-		{
-			switch (shape[i])
-			{
-			case 0:
-				if (rotation[i] == 0)
-				{
-					shapeCells[i] = GetCell(xPosition[i], yPosition[i]);
-					shapeCells[i+1] = GetCell(xPosition[i] + 1, yPosition[i]);
-					shapeCells[i+2] = GetCell(xPosition[i] + 2, yPosition[i]);
-					shapeCells[i+3] = GetCell(xPosition[i] + 3, yPosition[i]);
-				}
-				else if (rotation[i] == 1)
-				{
-					shapeCells[i] = GetCell(xPosition[i], yPosition[i]);
-					shapeCells[i+1] = GetCell(xPosition[i], yPosition[i] - 1);
-					shapeCells[i+2] = GetCell(xPosition[i], yPosition[i] - 2);
-					shapeCells[i+3] = GetCell(xPosition[i], yPosition[i] - 3);
-				}
-				break;
-			case 1:
-				if (rotation[i] == 0)
-				{
-					shapeCells[i] = GetCell(xPosition[i], yPosition[i]);
-					shapeCells[i+1] = GetCell(xPosition[i] + 1, yPosition[i]);
-					shapeCells[i+2] = GetCell(xPosition[i] + 2, yPosition[i]);
-					shapeCells[i+3] = GetCell(xPosition[i], yPosition[i] - 1);
-				}
-				else if (rotation[i] == 1)
-				{
-					shapeCells[i] = GetCell(xPosition[i], yPosition[i]);
-					shapeCells[i+1] = GetCell(xPosition[i], yPosition[i] - 1);
-					shapeCells[i+2] = GetCell(xPosition[i], yPosition[i] - 2);
-					shapeCells[i+3] = GetCell(xPosition[i] + 1, yPosition[i] - 2);
-				}
-				else if (rotation[i] == 2)
-				{
-					shapeCells[i] = GetCell(xPosition[i], yPosition[i] - 1);
-					shapeCells[i+1] = GetCell(xPosition[i] + 1, yPosition[i] - 1);
-					shapeCells[i+2] = GetCell(xPosition[i] + 2, yPosition[i] - 1);
-					shapeCells[i+3] = GetCell(xPosition[i] + 2, yPosition[i]);
-				}
-				else if (rotation[i] == 3)
-				{
-					shapeCells[i] = GetCell(xPosition[i] + 1, yPosition[i]);
-					shapeCells[i+1] = GetCell(xPosition[i] + 1, yPosition[i] - 1);
-					shapeCells[i+2] = GetCell(xPosition[i] + 1, yPosition[i] - 2);
-					shapeCells[i+3] = GetCell(xPosition[i], yPosition[i]);
-				}
-				break;
-			case 2:
-				if (rotation[i] == 0)
-				{
-					shapeCells[i] = GetCell(xPosition[i], yPosition[i]);
-					shapeCells[i+1] = GetCell(xPosition[i] + 1, yPosition[i]);
-					shapeCells[i+2] = GetCell(xPosition[i] + 2, yPosition[i]);
-					shapeCells[i+3] = GetCell(xPosition[i] + 2, yPosition[i] - 1);
-				}
-				else if (rotation[i] == 1)
-				{
-					shapeCells[i] = GetCell(xPosition[i], yPosition[i]);
-					shapeCells[i+1] = GetCell(xPosition[i], yPosition[i] - 1);
-					shapeCells[i+2] = GetCell(xPosition[i], yPosition[i] - 2);
-					shapeCells[i+3] = GetCell(xPosition[i] + 1, yPosition[i]);
-				}
-				else if (rotation[i] == 2)
-				{
-					shapeCells[i] = GetCell(xPosition[i], yPosition[i] - 1);
-					shapeCells[i+1] = GetCell(xPosition[i] + 1, yPosition[i] - 1);
-					shapeCells[i+2] = GetCell(xPosition[i] + 2, yPosition[i] - 1);
-					shapeCells[i+3] = GetCell(xPosition[i], yPosition[i]);
-				}
-				else if (rotation[i] == 3)
-				{
-					shapeCells[i] = GetCell(xPosition[i] + 1, yPosition[i]);
-					shapeCells[i+1] = GetCell(xPosition[i] + 1, yPosition[i] - 1);
-					shapeCells[i+2] = GetCell(xPosition[i] + 1, yPosition[i] - 2);
-					shapeCells[i+3] = GetCell(xPosition[i], yPosition[i] - 2);
-				}
-				break;
-			case 3:
-				if (rotation[i] == 0)
-				{
-					shapeCells[i] = GetCell(xPosition[i], yPosition[i]);
-					shapeCells[i+1] = GetCell(xPosition[i] + 1, yPosition[i]);
-					shapeCells[i+2] = GetCell(xPosition[i], yPosition[i] - 1);
-					shapeCells[i+3] = GetCell(xPosition[i] + 1, yPosition[i] - 1);
-				}
-				break;
-			case 4:
-				if (rotation[i] == 0)
-				{
-					shapeCells[i] = GetCell(xPosition[i], yPosition[i]);
-					shapeCells[i+1] = GetCell(xPosition[i] + 1, yPosition[i]);
-					shapeCells[i+2] = GetCell(xPosition[i] + 1, yPosition[i] - 1);
-					shapeCells[i+3] = GetCell(xPosition[i] + 2, yPosition[i] - 1);
-				}
-				else if (rotation[i] == 1)
-				{
-					shapeCells[i] = GetCell(xPosition[i] + 1, yPosition[i]);
-					shapeCells[i+1] = GetCell(xPosition[i] + 1, yPosition[i] - 1);
-					shapeCells[i+2] = GetCell(xPosition[i], yPosition[i] - 1);
-					shapeCells[i+3] = GetCell(xPosition[i], yPosition[i] - 2);
-				}
-				break;
-			case 5:
-				if (rotation[i] == 0)
-				{
-					shapeCells[i] = GetCell(xPosition[i], yPosition[i]);
-					shapeCells[i+1] = GetCell(xPosition[i] + 1, yPosition[i]);
-					shapeCells[i+2] = GetCell(xPosition[i] + 2, yPosition[i]);
-					shapeCells[i+3] = GetCell(xPosition[i] + 1, yPosition[i] - 1);
-				}
-				else if (rotation[i] == 1)
-				{
-					shapeCells[i] = GetCell(xPosition[i], yPosition[i]);
-					shapeCells[i+1] = GetCell(xPosition[i], yPosition[i] - 1);
-					shapeCells[i+2] = GetCell(xPosition[i], yPosition[i] - 2);
-					shapeCells[i+3] = GetCell(xPosition[i] + 1, yPosition[i] - 1);
-				}
-				else if (rotation[i] == 2)
-				{
-					shapeCells[i] = GetCell(xPosition[i] + 1, yPosition[i]);
-					shapeCells[i+1] = GetCell(xPosition[i], yPosition[i] - 1);
-					shapeCells[i+2] = GetCell(xPosition[i] + 1, yPosition[i] - 1);
-					shapeCells[i+3] = GetCell(xPosition[i] + 2, yPosition[i] - 1);
-				}
-				else if (rotation[i] == 3)
-				{
-					shapeCells[i] = GetCell(xPosition[i], yPosition[i] - 1);
-					shapeCells[i+1] = GetCell(xPosition[i] + 1, yPosition[i]);
-					shapeCells[i+2] = GetCell(xPosition[i] + 1, yPosition[i] - 1);
-					shapeCells[i+3] = GetCell(xPosition[i] + 1, yPosition[i] - 2);
-				}
-				break;
-			case 6:
-				if (rotation[i] == 0)
-				{
-					shapeCells[i] = GetCell(xPosition[i] + 1, yPosition[i]);
-					shapeCells[i+1] = GetCell(xPosition[i] + 2, yPosition[i]);
-					shapeCells[i+2] = GetCell(xPosition[i], yPosition[i] - 1);
-					shapeCells[i+3] = GetCell(xPosition[i] + 1, yPosition[i] - 1);
-				}
-				else if (rotation[i] == 1)
-				{
-					shapeCells[i] = GetCell(xPosition[i], yPosition[i]);
-					shapeCells[i+1] = GetCell(xPosition[i], yPosition[i] - 1);
-					shapeCells[i+2] = GetCell(xPosition[i] + 1, yPosition[i] - 1);
-					shapeCells[i+3] = GetCell(xPosition[i] + 1, yPosition[i] - 2);
-				}
-				break;
-
-			default:
-				return false;
-			}
-		}
-
-		//Set first piece cells to grid
-		for(unsigned int i = 0; i < 4; i++)
-		{
-			SetCell(shapeCells[i].x(), shapeCells[i].y(), 2);
-		}
-
-		//Check for a collision
-		//Now get the cells of the second piece and check if they are blocked, if so we have a collision
-		for(unsigned int i = 4; i < 8; i++)
-		{
-			if (shapeCells[i].IsBlock())
-			{
-				collision = true;
-			}
-		}
-
-		//Reset cells
-		for (unsigned int i = 0; i < 4; i++)
-		{
-			SetCell(shapeCells[i].x(), shapeCells[i].y(), 2);
-		}
-
-		return collision;
-	}
-
-	bool IsAccessible(const Cell& c) const
-	{
-		auto accessible = true;
-
-		const auto xPosition = c.x();
-		const auto yPosition = c.y();
-
-		const auto loopLimit = yPosition - 8 < 0 ? 0 : yPosition - 8;
-
-		for (auto y = yPosition; y >= loopLimit; y--)
-		{
-			auto cell = GetCell(xPosition, y);
-
-			if (cell.IsBlock() || cell.IsSolid())
-			{
-				accessible = false;
-				break;
-			}
-		}		
-
-		return accessible;
+		return (reachable[c.y()] >> c.x() & 1) != 0;
 	}
 
 	bool DetectGameLoss() const
 	{
-		vector<int> blockPositions;
-
 		for (auto x = 0; x < width_; x++)
 		{
-			if (GetCell(x, 0).IsShape())
-			{
-				blockPositions.emplace_back(x);
-			}
-		}
-
-		auto count = 0;
-
-		for (auto x : blockPositions)
-		{
-			if (GetCell(x, 1).IsBlock())
+			if (GetCell(x, 0).IsShape() && GetCell(x, 1).IsBlock())
 			{
 				return true;
 			}
@@ -530,7 +572,13 @@ public:
 	}
 
 	const Cell& GetCell(int x, int y) const { return grid_[y * width_ + x]; }
-	void SetCell(const int x, const int y, const int state) { grid_[y*width_ + x].set_state(state); }
+	void SetCell(const int x, const int y, const int state)
+	{
+		grid_[y*width_ + x].set_state(state);
+		board_.Set(x, y, state == Cell::BLOCK || state == Cell::SOLID, state == Cell::SOLID);
+
+		shapeRows_[y] = state == Cell::SHAPE ? shapeRows_[y] | 1u << x : shapeRows_[y] & ~(1u << x);
+	}
 
 	int width() const { return width_; }
 
@@ -539,89 +587,69 @@ public:
 private:
 	void CalculateMoveScore(double &totalScore) const
 	{
-		int heights[10];
+		MoveFeatures features;
+		CalculateMoveFeatures(features);
 
-		auto sumOfHeights = 0;
-		auto completedLines = 0;
-		auto blockHolesCount = 0;
-		auto surfaceRoughness = 0;
+		//cerr << "SumOfHeights: " << features.sumOfHeights << ", CompletedLines: " << features.completedLines << ", SealedHoles: " << features.sealedHoles << ", Overhangs: " << features.overhangs << ", SurfaceRoughness: " << features.surfaceRoughness << endl;
 
-		//Analysis the grid and gather values to determine the above values
-
-		//Calculate sumOfHeights and store heights and keep track of inaccessible blocked holes
-		for (auto x = 0; x < width_; x++)
-		{
-			auto yHoleCount = 0;
-			auto height = 0;
+		totalScore = m_sumOfHeightsWeight * features.sumOfHeights + m_completedLinesWeight * features.completedLines +
+			m_blockedHoleCountWeight * features.sealedHoles + m_overhangHoleWeight * features.overhangs + m_surfaceRoughness * features.surfaceRoughness;
 
-			for (auto y = height_ - 1; y >= 0; y--)
-			{
-				auto cell = GetCell(x, y);
-
-				if (cell.IsBlock() || cell.IsSolid())
-				{
-					height = height_ - y;
-				}
-
-				if (cell.IsEmpty())
-				{
-					yHoleCount++;
+		//cerr << "MoveScore: " << totalScore << endl;
+	}
 
+	void CalculateMoveFeatures(MoveFeatures& features) const
+	{
+		int heights[BitBoard::kMaxWidth];
 
-					continue;
-				}
+		features.sumOfHeights = 0;
+		features.completedLines = 0;
+		features.surfaceRoughness = 0;
 
-				if (cell.IsBlock() || cell.IsSolid())
-				{
-					blockHolesCount += yHoleCount;
-					yHoleCount = 0;
-				}
-			}
+		//Analysis the grid and gather values to determine the above values
 
-			sumOfHeights += height;
-			heights[x] = height;
+		//Heights of the block and solid cells come from the skyline of the board
+		for (auto x = 0; x < width_; x++)
+		{
+			heights[x] = board_.ColumnHeight(x);
+			features.sumOfHeights += heights[x];
 		}
 
-		//Calculate completedLines
-		for (auto y = 0; y < height_; y++)
+		//Holes a piece can still slide into weigh less than sealed ones, falling piece cells are neither filled nor holes
+		const auto holes = board_.ClassifyHoles(shapeRows_);
+		features.sealedHoles = holes.sealed;
+		features.overhangs = holes.overhangs;
+
+		//Calculate completedLines, rows of blocks and falling piece cells, solid rows never complete
+		const auto playableRows = height_ - board_.SolidRows();
+		for (auto y = 0; y < playableRows; y++)
 		{
-			for (auto x = 0; x < width_; x++)
+			if ((board_.Row(y) | shapeRows_[y]) == board_.FullRow())
 			{
-				const auto cell = GetCell(x, y);
-
-				if (cell.IsEmpty() || cell.IsSolid())
-				{
-					break;
-				}
-				
-				if (x == width_ - 1)
-				{
-					completedLines++;
-				}
+				features.completedLines++;
 			}
 		}
 
 		//Calculate surface roughness
-		for (unsigned int i = 0; i < 9; i++)
+		for (auto x = 0; x + 1 < width_; x++)
 		{
-			surfaceRoughness += abs(heights[i] - heights[i + 1]);
+			features.surfaceRoughness += abs(heights[x] - heights[x + 1]);
 		}
-
-		//cerr << "SumOfHeights: " << sumOfHeights << ", CompletedLines: " << completedLines << ", BlockedHolesCount: " << blockHolesCount << ", SurfaceRoughness: " << surfaceRoughness << endl;
-
-		totalScore = m_sumOfHeightsWeight * sumOfHeights + m_completedLinesWeight * completedLines + m_blockedHoleCountWeight * blockHolesCount + m_surfaceRoughness * surfaceRoughness;
-
-		//cerr << "MoveScore: " << totalScore << endl;
 	}
 
 	double m_sumOfHeightsWeight = -0.510066;
 	double m_completedLinesWeight = 0.760666;
 	double m_blockedHoleCountWeight = -0.35663;
+	// At most the weight of a sealed hole, ScoreBound relies on it.
+	double m_overhangHoleWeight = -0.25;
 	double m_surfaceRoughness = -0.184483;
 
 	int width_;
 	int height_;
 	vector<Cell> grid_;
+	BitBoard board_;
+	// Falling piece cells as row masks, see SetCell.
+	uint32_t shapeRows_[BitBoard::kMaxHeight] = {};
 };
 
 #endif  // __FIELD_H
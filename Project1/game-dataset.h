@@ -0,0 +1,474 @@
+#ifndef __GAME_DATASET_H
+#define __GAME_DATASET_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bit-board.h"
+#include "worker-pool.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/**
+ * Binary dataset of played decisions for analytics and offline training.
+ * A file is a FileHeader followed by games back to back. A game is a
+ * GameHeader followed by its decisions, and each decision is a
+ * DecisionHeader followed by the board rows that differ from the board of
+ * the previous decision in the game (an empty board for the first one):
+ * one uint16 per set bit of changedRows, top row first. Consecutive rounds
+ * differ in a few rows only, so a decision is typically 20 to 30 bytes.
+ * All values are little endian and stored as they lie in memory.
+ */
+struct DatasetFormat {
+	static const uint32_t kMagic = 0x52474242;
+	static const uint32_t kVersion = 1;
+
+	struct FileHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t width;
+		uint32_t height;
+	};
+
+	struct GameHeader {
+		// Size of the decisions that follow.
+		uint32_t bytes;
+		uint32_t decisions;
+		// 1 won, -1 lost, 0 unknown.
+		int8_t outcome;
+		uint8_t padding[3];
+	};
+
+	struct DecisionHeader {
+		uint32_t changedRows;
+		float score;
+		uint16_t round;
+		// Current shape in the low nibble, next shape in the high one.
+		uint8_t shapes;
+		uint8_t solidRows;
+		int8_t rotation;
+		int8_t x;
+		int8_t y;
+		uint8_t padding;
+	};
+};
+
+// One decoded decision, the board before the piece was placed comes alongside.
+struct DatasetSample {
+	size_t game;
+	int round;
+	int currentShape;
+	int nextShape;
+	Placement placement;
+	float score;
+	int outcome;
+};
+
+/**
+ * Buffers the decisions of the running game and appends the game to the
+ * file when it ends. The buffer is reserved up front so recording does
+ * not allocate during actions.
+ */
+class GameRecorder {
+public:
+	explicit GameRecorder(const string& path) : path_(path) { buffer_.reserve(kReservedBytes); }
+
+	~GameRecorder() { EndGame(0); }
+
+	GameRecorder(const GameRecorder&) = delete;
+	GameRecorder& operator=(const GameRecorder&) = delete;
+
+	void Record(const BitBoard& board, const int round, const int currentShape, const int nextShape,
+		const int rotation, const int x, const int y, const float score)
+	{
+		if (decisions_ == 0)
+		{
+			width_ = board.width();
+			height_ = board.height();
+			memset(previous_, 0, sizeof(previous_));
+		}
+
+		DatasetFormat::DecisionHeader header = {};
+		header.score = score;
+		header.round = static_cast<uint16_t>(round);
+		header.shapes = static_cast<uint8_t>(currentShape | nextShape << 4);
+		header.solidRows = static_cast<uint8_t>(board.SolidRows());
+		header.rotation = static_cast<int8_t>(rotation);
+		header.x = static_cast<int8_t>(x);
+		header.y = static_cast<int8_t>(y);
+
+		for (auto row = 0; row < board.height(); row++)
+		{
+			if (board.Row(row) != previous_[row])
+			{
+				header.changedRows |= 1u << row;
+			}
+		}
+
+		Append(&header, sizeof(header));
+
+		for (auto row = 0; row < board.height(); row++)
+		{
+			if (header.changedRows >> row & 1)
+			{
+				previous_[row] = static_cast<uint16_t>(board.Row(row));
+				Append(&previous_[row], sizeof(uint16_t));
+			}
+		}
+
+		decisions_++;
+	}
+
+	// Writes the buffered game with its outcome, the file is created on the first game.
+	bool EndGame(const int outcome)
+	{
+		if (decisions_ == 0)
+		{
+			return true;
+		}
+
+		const auto decisions = decisions_;
+		decisions_ = 0;
+
+		DatasetFormat::FileHeader fileHeader = { DatasetFormat::kMagic, DatasetFormat::kVersion,
+			static_cast<uint32_t>(width_), static_cast<uint32_t>(height_) };
+		DatasetFormat::FileHeader existing = {};
+
+		ifstream check(path_, ios::binary);
+		const auto hasHeader = static_cast<bool>(check.read(reinterpret_cast<char*>(&existing), sizeof(existing)));
+		check.close();
+
+		if (hasHeader && memcmp(&existing, &fileHeader, sizeof(fileHeader)) != 0)
+		{
+			cerr << "Dataset " << path_ << " has another format or field size, game not recorded" << endl;
+			buffer_.clear();
+			return false;
+		}
+
+		ofstream out(path_, ios::binary | ios::app);
+		if (!hasHeader)
+		{
+			out.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+		}
+
+		DatasetFormat::GameHeader gameHeader = {};
+		gameHeader.bytes = static_cast<uint32_t>(buffer_.size());
+		gameHeader.decisions = decisions;
+		gameHeader.outcome = static_cast<int8_t>(outcome);
+
+		out.write(reinterpret_cast<const char*>(&gameHeader), sizeof(gameHeader));
+		out.write(buffer_.data(), buffer_.size());
+		buffer_.clear();
+
+		if (!out)
+		{
+			cerr << "Unable to write dataset " << path_ << endl;
+			return false;
+		}
+		return true;
+	}
+
+private:
+	// Room for about ten thousand decisions before the buffer has to grow.
+	static const size_t kReservedBytes = 256 * 1024;
+
+	void Append(const void* data, const size_t bytes)
+	{
+		const auto start = buffer_.size();
+		buffer_.resize(start + bytes);
+		memcpy(&buffer_[start], data, bytes);
+	}
+
+	string path_;
+	vector<char> buffer_;
+	uint16_t previous_[BitBoard::kMaxHeight];
+	uint32_t decisions_ = 0;
+	int width_ = 0;
+	int height_ = 0;
+};
+
+/**
+ * Read-only view of a dataset file. The file is memory-mapped and decoded
+ * in place, opening it only walks the game headers to index them.
+ * Games decode independently, which is what ParallelScan splits on.
+ */
+class GameDataset {
+public:
+	typedef function<void(const DatasetSample&, const BitBoard&)> Visitor;
+
+	GameDataset() {}
+
+	~GameDataset() { Close(); }
+
+	GameDataset(const GameDataset&) = delete;
+	GameDataset& operator=(const GameDataset&) = delete;
+
+	bool Open(const string& path)
+	{
+		Close();
+
+		if (!Map(path))
+		{
+			cerr << "Unable to map dataset " << path << endl;
+			return false;
+		}
+
+		DatasetFormat::FileHeader header;
+		if (bytes_ < sizeof(header))
+		{
+			cerr << "Dataset " << path << " is too short" << endl;
+			Close();
+			return false;
+		}
+
+		memcpy(&header, base_, sizeof(header));
+		if (header.magic != DatasetFormat::kMagic || header.version != DatasetFormat::kVersion ||
+			header.width > static_cast<uint32_t>(BitBoard::kMaxWidth) || header.height > static_cast<uint32_t>(BitBoard::kMaxHeight))
+		{
+			cerr << "Unsupported dataset " << path << endl;
+			Close();
+			return false;
+		}
+
+		width_ = static_cast<int>(header.width);
+		height_ = static_cast<int>(header.height);
+
+		auto offset = sizeof(header);
+		while (offset + sizeof(DatasetFormat::GameHeader) <= bytes_)
+		{
+			DatasetFormat::GameHeader game;
+			memcpy(&game, base_ + offset, sizeof(game));
+
+			if (offset + sizeof(game) + game.bytes > bytes_)
+			{
+				cerr << "Dataset " << path << " ends in a truncated game, it is skipped" << endl;
+				break;
+			}
+
+			games_.push_back(offset);
+			decisions_ += game.decisions;
+			offset += sizeof(game) + game.bytes;
+		}
+
+		return true;
+	}
+
+	int width() const { return width_; }
+
+	int height() const { return height_; }
+
+	size_t GameCount() const { return games_.size(); }
+
+	uint64_t DecisionCount() const { return decisions_; }
+
+	// Decodes the decisions of one game in order.
+	template <class GameVisitor>
+	void ScanGame(const size_t game, GameVisitor&& visit) const
+	{
+		DatasetFormat::GameHeader header;
+		memcpy(&header, base_ + games_[game], sizeof(header));
+
+		const char* cursor = base_ + games_[game] + sizeof(header);
+		const char* end = cursor + header.bytes;
+
+		BitBoard board(width_, height_);
+		DatasetSample sample;
+		sample.game = game;
+		sample.outcome = header.outcome;
+
+		for (uint32_t i = 0; i < header.decisions && cursor + sizeof(DatasetFormat::DecisionHeader) <= end; i++)
+		{
+			DatasetFormat::DecisionHeader decision;
+			memcpy(&decision, cursor, sizeof(decision));
+			cursor += sizeof(decision);
+
+			if (cursor + PopCount(decision.changedRows) * sizeof(uint16_t) > end)
+			{
+				break;
+			}
+
+			auto changed = decision.changedRows;
+			while (changed != 0)
+			{
+				uint16_t row;
+				memcpy(&row, cursor, sizeof(row));
+				cursor += sizeof(row);
+
+				board.SetRow(CountTrailingZeros(changed), row);
+				changed &= changed - 1;
+			}
+			board.SetSolidRows(decision.solidRows);
+
+			sample.round = decision.round;
+			sample.currentShape = decision.shapes & 0xF;
+			sample.nextShape = decision.shapes >> 4;
+			sample.placement.rotation = decision.rotation;
+			sample.placement.x = decision.x;
+			sample.placement.y = decision.y;
+			sample.score = decision.score;
+
+			visit(sample, board);
+		}
+	}
+
+	template <class GameVisitor>
+	void Scan(GameVisitor&& visit) const
+	{
+		for (size_t game = 0; game < games_.size(); game++)
+		{
+			ScanGame(game, visit);
+		}
+	}
+
+	// Scans all games on the pool, visit is called concurrently from several workers.
+	void ParallelScan(WorkerPool& pool, const int client, const Visitor& visit) const
+	{
+		const auto ranges = static_cast<int>(min(games_.size(), pool.size() * kRangesPerWorker));
+		const auto gameCount = games_.size();
+
+		pool.ParallelFor(client, 0, ranges, [this, ranges, gameCount, &visit](const int range) {
+			const auto first = gameCount * range / ranges;
+			const auto last = gameCount * (range + 1) / ranges;
+
+			for (auto game = first; game < last; game++)
+			{
+				ScanGame(game, visit);
+			}
+		});
+	}
+
+private:
+	// Several ranges per worker even out games of different lengths.
+	static const size_t kRangesPerWorker = 4;
+
+#ifdef _WIN32
+	bool Map(const string& path)
+	{
+		file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		LARGE_INTEGER size;
+		if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &size) || size.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+
+		mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping_ == nullptr)
+		{
+			Close();
+			return false;
+		}
+
+		base_ = static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+		if (base_ == nullptr)
+		{
+			Close();
+			return false;
+		}
+
+		bytes_ = static_cast<size_t>(size.QuadPart);
+		return true;
+	}
+
+	void Close()
+	{
+		if (base_ != nullptr)
+		{
+			UnmapViewOfFile(base_);
+		}
+		if (mapping_ != nullptr)
+		{
+			CloseHandle(mapping_);
+		}
+		if (file_ != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(file_);
+		}
+
+		base_ = nullptr;
+		mapping_ = nullptr;
+		file_ = INVALID_HANDLE_VALUE;
+		Reset();
+	}
+
+	HANDLE file_ = INVALID_HANDLE_VALUE;
+	HANDLE mapping_ = nullptr;
+#else
+	bool Map(const string& path)
+	{
+		const auto fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return false;
+		}
+
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0)
+		{
+			close(fd);
+			return false;
+		}
+
+		//The mapping keeps the file alive on its own
+		void* base = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (base == MAP_FAILED)
+		{
+			return false;
+		}
+
+		madvise(base, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+		base_ = static_cast<const char*>(base);
+		bytes_ = static_cast<size_t>(info.st_size);
+		return true;
+	}
+
+	void Close()
+	{
+		if (base_ != nullptr)
+		{
+			munmap(const_cast<char*>(base_), bytes_);
+		}
+
+		base_ = nullptr;
+		Reset();
+	}
+#endif
+
+	void Reset()
+	{
+		bytes_ = 0;
+		games_.clear();
+		decisions_ = 0;
+		width_ = 0;
+		height_ = 0;
+	}
+
+	const char* base_ = nullptr;
+	size_t bytes_ = 0;
+	vector<size_t> games_;
+	uint64_t decisions_ = 0;
+	int width_ = 0;
+	int height_ = 0;
+};
+
+#endif  // __GAME_DATASET_H
@@ -1,21 +1,150 @@
 // Christos Savvopoulos <savvopoulos@gmail.com>
 // Elias Sprengel <blockbattle@webagent.eu>
 
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
+#include <new>
 
+#include "allocation-counter.h"
+#include "batch-decider.h"
+#include "bot-config.h"
 #include "bot-starter.h"
 #include "bot-parser.h"
+#include "ensemble-evaluator.h"
+#include "game-dataset.h"
+#include "neural-evaluator.h"
+#include "pattern-cache.h"
+#include "perft.h"
+#include "phase-profiler.h"
+#include "referee.h"
+#include "server.h"
+#include "soak.h"
 
 using namespace std;
 
+#ifdef BLOCKBATTLE_COUNT_ALLOCATIONS
+// Counts every heap allocation of the thread, see AllocationCounter.
+void* operator new(size_t size) {
+  AllocationCounter::Record();
+  if (void* memory = malloc(size == 0 ? 1 : size)) {
+    return memory;
+  }
+  throw bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void* memory) noexcept { free(memory); }
+
+void operator delete[](void* memory) noexcept { free(memory); }
+
+void operator delete(void* memory, size_t) noexcept { free(memory); }
+
+void operator delete[](void* memory, size_t) noexcept { free(memory); }
+#endif
+
+// Scans a recorded dataset on all cores and prints what is in it.
+static int PrintDatasetStats(const BotConfig& config) {
+  GameDataset dataset;
+  if (!dataset.Open(config.datasetStatsPath)) {
+    return 1;
+  }
+
+  WorkerPool pool(config.workerThreads);
+  atomic<long long> decisions(0), wins(0), losses(0), heightSum(0), holeSum(0);
+
+  const auto started = chrono::steady_clock::now();
+  dataset.ParallelScan(pool, 0, [&](const DatasetSample& sample, const BitBoard& board) {
+    decisions++;
+    wins += sample.outcome > 0 ? 1 : 0;
+    losses += sample.outcome < 0 ? 1 : 0;
+    int maxHeight = 0;
+    for (int x = 0; x < board.width(); ++x) {
+      maxHeight = max(maxHeight, board.ColumnHeight(x));
+    }
+    heightSum += maxHeight;
+    holeSum += board.HoleCount();
+  });
+  const double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+  const double count = max(1.0, static_cast<double>(decisions));
+  cout << dataset.GameCount() << " games, " << decisions << " decisions on " << dataset.width() << "x" << dataset.height()
+       << " fields" << endl;
+  cout << "decisions from won games " << wins << ", lost " << losses << endl;
+  cout << "mean max height " << heightSum / count << ", mean holes " << holeSum / count << endl;
+  cout << "scanned in " << seconds * 1000.0 << " ms, " << static_cast<long long>(decisions / max(seconds, 1e-9))
+       << " decisions/s on " << pool.size() << " workers" << endl;
+  return 0;
+}
+
 /**
  * Main File, starts the whole process.
 **/
 
-int main() {
+int main(int argc, char* argv[]) {
   // initialize random seed for our results to be reproducable
   srand(17);
-  BotStarter botStarter;
+  BotConfig config = BotConfig::Parse(argc, argv);
+
+  if (!config.datasetStatsPath.empty()) {
+    return PrintDatasetStats(config);
+  }
+
+  if (!config.perftPath.empty()) {
+    WorkerPool pool(config.workerThreads);
+    return PerftRunner::Run(config.perftPath, config.perftDepth, pool);
+  }
+
+  if (!config.refereeCommand.empty()) {
+    return Referee(config).Run();
+  }
+
+  if (config.soakRounds > 0) {
+    return SoakBenchmark(config).Run();
+  }
+
+  if (!config.serverPath.empty()) {
+    SessionServer server(config);
+    return server.Run();
+  }
+
+  BotStarter botStarter(config);
+  PatternCache patternCache;
+  if (!config.patternCachePath.empty() &&
+      patternCache.Open(config.patternCachePath, config.patternCacheMb, PatternCache::Fingerprint(config))) {
+    botStarter.SetPatternCache(&patternCache);
+  }
+  NeuralEvaluator neuralEvaluator;
+  if (!config.neuralWeightsPath.empty() && neuralEvaluator.Load(config.neuralWeightsPath)) {
+    botStarter.SetNeuralEvaluator(&neuralEvaluator);
+  }
+  EnsembleEvaluator ensembleEvaluator;
+  if (!config.ensemblePath.empty() && ensembleEvaluator.Load(config.ensemblePath, config.ensembleCombine)) {
+    botStarter.SetEnsembleEvaluator(&ensembleEvaluator);
+  }
+  unique_ptr<GameRecorder> recorder;
+  if (!config.recordPath.empty()) {
+    recorder.reset(new GameRecorder(config.recordPath));
+    botStarter.SetRecorder(recorder.get());
+  }
+  unique_ptr<PhaseProfiler> profiler;
+  if (!config.profilePath.empty()) {
+    profiler.reset(new PhaseProfiler(config.profilePath));
+    botStarter.SetProfiler(profiler.get());
+  }
+  // Its pool only starts with the first batch command.
+  BatchDecider batchDecider(config);
+  if (neuralEvaluator.IsLoaded()) {
+    batchDecider.SetNeuralEvaluator(&neuralEvaluator);
+  }
+  if (ensembleEvaluator.IsLoaded()) {
+    batchDecider.SetEnsembleEvaluator(&ensembleEvaluator);
+  }
   BotParser parser(botStarter);
+  parser.SetBatchDecider(&batchDecider);
   parser.Run();
+
+  // Debug builds fail the run when actions kept allocating after the warm-up.
+  return AllocationCounter::Failures() == 0 ? 0 : 1;
 }
@@ -0,0 +1,181 @@
+#ifndef __MASK_TABLES_H
+#define __MASK_TABLES_H
+
+#include <cstdint>
+
+#include "bit-board.h"
+
+using namespace std;
+
+/**
+ * Evaluation terms of whole rows and columns read from tables instead of
+ * cell by cell. A row of up to kChunkBits cells is one lookup into a 2 KB
+ * table, wider rows are counted with bit operations. Columns are masks
+ * with bit k set when the cell k rows above the floor is filled, see
+ * BitBoard::ColumnMask, looked up kColumnBits rows at a time from the top.
+ * A table of every 20 row column would take megabytes and miss the cache,
+ * so by default the chunks are 10 rows and the table 4 KB. Building with
+ * BLOCKBATTLE_WIDE_COLUMN_TABLE makes them 16 rows and the table 256 KB,
+ * which still stays in L2 and answers most columns in one lookup. The
+ * tables are built on first use.
+ */
+class MaskTables {
+public:
+	static const int kChunkBits = 10;
+
+#ifdef BLOCKBATTLE_WIDE_COLUMN_TABLE
+	static const int kColumnBits = 16;
+#else
+	static const int kColumnBits = 10;
+#endif
+
+	struct RowStats {
+		int filled;
+		// Filled/empty changes along the row, the side walls count as filled.
+		int transitions;
+	};
+
+	struct ColumnStats {
+		// Rows from the floor up to the highest filled cell.
+		int height;
+		int filled;
+		// Empty cells under the highest filled cell.
+		int holes;
+		// Filled cells above each hole, summed over the holes.
+		int holeDepth;
+	};
+
+	static RowStats Row(const uint32_t row, const int width)
+	{
+		RowStats stats;
+
+		if (width <= kChunkBits)
+		{
+			//The table counts the changes up to the first cell past the row, which is empty instead of a wall
+			const auto& entry = Table().rows[row];
+			stats.filled = entry.filled;
+			stats.transitions = entry.changes + ((row & 1) != 0 ? 0 : 1) + ((row >> (width - 1) & 1) != 0 ? -1 : 1);
+			return stats;
+		}
+
+		const auto walled = row << 1 | 1u | 1u << (width + 1);
+		stats.filled = PopCount(row);
+		stats.transitions = PopCount(walled ^ walled >> 1) - 1;
+		return stats;
+	}
+
+	// Column mask of a field of the given height, bits at and above it must be clear.
+	static ColumnStats Column(const uint32_t column, const int height)
+	{
+		ColumnStats stats = { 0, 0, 0, 0 };
+		const ColumnEntry* const columns = Columns();
+		auto covered = false;
+
+		for (auto chunk = (height - 1) / kColumnBits; chunk >= 0; chunk--)
+		{
+			const auto bits = column >> (chunk * kColumnBits) & kColumnMask;
+
+			//Empty chunks above the stack add nothing
+			if (!covered && bits == 0)
+			{
+				continue;
+			}
+
+			const auto& entry = columns[bits];
+			if (covered)
+			{
+				//Every empty cell of the chunk is under the filled cells counted so far
+				const auto empty = kColumnBits - entry.filled;
+				stats.holes += empty;
+				stats.holeDepth += empty * stats.filled + entry.holeDepth;
+			}
+			else
+			{
+				stats.height = chunk * kColumnBits + entry.height;
+				stats.holes += entry.holes;
+				stats.holeDepth += entry.holeDepth;
+				covered = true;
+			}
+			stats.filled += entry.filled;
+		}
+
+		return stats;
+	}
+
+private:
+	static const uint32_t kColumnMask = (1u << kColumnBits) - 1;
+
+	struct RowEntry {
+		uint8_t filled;
+		// Neighbouring cells that differ, the cell past the last one counts as empty.
+		uint8_t changes;
+	};
+
+	struct ColumnEntry {
+		uint8_t height;
+		uint8_t filled;
+		uint8_t holes;
+		uint8_t holeDepth;
+	};
+
+	struct Tables {
+		RowEntry rows[1 << kChunkBits];
+	};
+
+	static const Tables& Table()
+	{
+		static const Tables tables = Build();
+		return tables;
+	}
+
+	static Tables Build()
+	{
+		Tables tables = {};
+
+		for (uint32_t mask = 0; mask < (1u << kChunkBits); mask++)
+		{
+			RowEntry& row = tables.rows[mask];
+			row.filled = static_cast<uint8_t>(PopCount(mask));
+			row.changes = static_cast<uint8_t>(PopCount(mask ^ mask >> 1));
+		}
+
+		return tables;
+	}
+
+	//Filled in place, the wide table is too large to be built on the stack and copied
+	static const ColumnEntry* Columns()
+	{
+		static ColumnEntry columns[1 << kColumnBits];
+		static const bool built = BuildColumns(columns);
+		(void)built;
+		return columns;
+	}
+
+	static bool BuildColumns(ColumnEntry* columns)
+	{
+		for (uint32_t mask = 0; mask < (1u << kColumnBits); mask++)
+		{
+			ColumnEntry& column = columns[mask];
+			column.filled = static_cast<uint8_t>(PopCount(mask));
+
+			auto above = 0;
+			for (auto bit = kColumnBits - 1; bit >= 0; bit--)
+			{
+				if (mask >> bit & 1)
+				{
+					column.height = column.height == 0 ? static_cast<uint8_t>(bit + 1) : column.height;
+					above++;
+				}
+				else if (above > 0)
+				{
+					column.holes++;
+					column.holeDepth = static_cast<uint8_t>(column.holeDepth + above);
+				}
+			}
+		}
+
+		return true;
+	}
+};
+
+#endif  // __MASK_TABLES_H
@@ -0,0 +1,586 @@
+#ifndef __MCTS_H
+#define __MCTS_H
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "bit-board.h"
+#include "evaluation.h"
+
+using namespace std;
+
+/**
+ * Monte Carlo tree search over placements.
+ * Decision nodes place a piece, chance nodes draw the next piece: the two
+ * known pieces are followed exactly, later ones are drawn at random.
+ * Leaves are finished with short rollouts using a cheap skyline policy,
+ * simulating garbage rows, solid rows, cleared lines and combos.
+ * All threads share one tree (tree parallelism). Every node on the path
+ * counts a visit before its reward arrives, a virtual loss that pushes
+ * the other threads onto different branches. The helper threads are
+ * started with the first search and wait between searches, so an action
+ * neither starts threads nor allocates.
+ */
+class MctsEngine {
+public:
+	typedef chrono::steady_clock Clock;
+
+	struct Result {
+		bool valid = false;
+		int rotation = 0;
+		int xPosition = 0;
+		int yPosition = 0;
+		long long playouts = 0;
+		double playoutsPerSecond = 0.0;
+		size_t nodesUsed = 0;
+		bool reusedTree = false;
+	};
+
+	// Pool size per node, for memory budgets. The pool is allocated on the first search.
+	static size_t NodeBytes() { return sizeof(Node); }
+
+	MctsEngine(const size_t nodeCapacity, const unsigned int threadCount)
+		: nodeCapacity_(max<size_t>(nodeCapacity, 1024)),
+		threadCount_(max(1u, threadCount == 0 ? thread::hardware_concurrency() : threadCount)) {}
+
+	~MctsEngine()
+	{
+		{
+			lock_guard<mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		wakeHelpers_.notify_all();
+
+		for (auto& helper : helpers_)
+		{
+			helper.join();
+		}
+	}
+
+	MctsEngine(const MctsEngine&) = delete;
+	MctsEngine& operator=(const MctsEngine&) = delete;
+
+	/**
+	 * Searches until the deadline and returns the most visited placement of
+	 * the current shape. round is used to know when solid rows come in.
+	 */
+	Result Search(const BitBoard& board, const int currentShape, const int nextShape, const int round,
+		const Clock::time_point deadline)
+	{
+		Result result;
+
+		if (!nodes_)
+		{
+			nodes_.reset(new Node[nodeCapacity_]);
+		}
+
+		known_[0] = currentShape;
+		known_[1] = nextShape;
+		round_ = round;
+
+		//A reused tree keeps the baseline its rewards were taken against, see ReuseTree
+		result.reusedTree = ReuseTree(board, currentShape);
+		if (!result.reusedTree)
+		{
+			baseline_ = EvaluateBoard(board, weights_);
+			nodeCount_ = 0;
+			root_ = Allocate(1);
+			InitNode(root_, board, kDecision, currentShape);
+		}
+
+		const auto started = Clock::now();
+		playouts_ = 0;
+
+		//The calling thread is searcher 0, the helpers are woken for the others
+		if (threadCount_ > 1)
+		{
+			if (helpers_.empty())
+			{
+				for (unsigned int i = 1; i < threadCount_; i++)
+				{
+					helpers_.emplace_back([this, i] { HelperLoop(i); });
+				}
+			}
+
+			{
+				lock_guard<mutex> lock(mutex_);
+				deadline_ = deadline;
+				helpersDone_ = 0;
+				generation_++;
+			}
+			wakeHelpers_.notify_all();
+		}
+
+		SearchUntil(0, deadline);
+
+		if (threadCount_ > 1)
+		{
+			unique_lock<mutex> lock(mutex_);
+			const auto helpers = helpers_.size();
+			helpersFinished_.wait(lock, [this, helpers] { return helpersDone_ == helpers; });
+		}
+
+		const auto seconds = chrono::duration<double>(Clock::now() - started).count();
+		const long long playouts = playouts_;
+		result.playouts = playouts;
+		result.playoutsPerSecond = seconds > 0.0 ? playouts / seconds : 0.0;
+		result.nodesUsed = min(static_cast<size_t>(nodeCount_), nodeCapacity_);
+
+		const Node& root = nodes_[root_];
+		if (root.expansion != kExpanded)
+		{
+			return result;
+		}
+
+		auto bestVisits = -1;
+		for (auto i = 0; i < root.childCount; i++)
+		{
+			const Node& child = nodes_[root.firstChild + i];
+			if (child.visits > bestVisits)
+			{
+				bestVisits = child.visits;
+				chosen_ = root.firstChild + i;
+			}
+		}
+
+		const Node& best = nodes_[chosen_];
+		result.valid = true;
+		result.rotation = best.move.rotation;
+		result.xPosition = best.move.x;
+		result.yPosition = best.move.y;
+		return result;
+	}
+
+private:
+	enum NodeKind { kDecision, kChance };
+	enum Expansion { kLeaf, kExpanding, kExpanded };
+
+	struct Node {
+		// Board after the move that led here, lines already cleared.
+		BitBoard board;
+		Placement move;
+		int8_t kind;
+		// Piece placed at a decision node.
+		int8_t piece;
+		atomic<bool> terminal;
+		int16_t points;
+		int16_t childCount;
+		int32_t firstChild;
+		atomic<int> expansion;
+		atomic<int> visits;
+		// Reward sum in 1/kRewardScale units, atomics have no floating point add.
+		atomic<long long> rewardSum;
+	};
+
+	static const int kMaxDepth = 48;
+	static const int kRolloutDepth = 6;
+	static const long long kRewardScale = 1 << 20;
+
+	int32_t Allocate(const int count)
+	{
+		const auto first = nodeCount_.fetch_add(count);
+		return first + static_cast<size_t>(count) <= nodeCapacity_ ? first : -1;
+	}
+
+	void InitNode(const int32_t index, const BitBoard& board, const int kind, const int piece)
+	{
+		Node& node = nodes_[index];
+		node.board = board;
+		node.move = Placement();
+		node.kind = static_cast<int8_t>(kind);
+		node.piece = static_cast<int8_t>(piece);
+		node.terminal = false;
+		node.points = 0;
+		node.childCount = 0;
+		node.firstChild = -1;
+		node.expansion = kLeaf;
+		node.visits = 0;
+		node.rewardSum = 0;
+	}
+
+	// Runs iterations on the shared tree until the deadline, i numbers the searcher.
+	void SearchUntil(const unsigned int i, const Clock::time_point deadline)
+	{
+		mt19937 random(static_cast<unsigned int>(round_ * 7919 + i));
+		long long local = 0;
+
+		//Check the clock every few iterations, it is not free
+		do
+		{
+			for (auto j = 0; j < 16; j++)
+			{
+				Iterate(random);
+				local++;
+			}
+		} while (Clock::now() < deadline);
+
+		playouts_ += local;
+	}
+
+	void HelperLoop(const unsigned int i)
+	{
+		auto searched = 0;
+		unique_lock<mutex> lock(mutex_);
+
+		while (true)
+		{
+			wakeHelpers_.wait(lock, [this, searched] { return stopping_ || generation_ != searched; });
+			if (stopping_)
+			{
+				return;
+			}
+			searched = generation_;
+			const auto deadline = deadline_;
+
+			lock.unlock();
+			SearchUntil(i, deadline);
+			lock.lock();
+
+			helpersDone_++;
+			helpersFinished_.notify_all();
+		}
+	}
+
+	/**
+	 * Re-roots onto the subtree of last round's choice when the board came
+	 * out as predicted. Its statistics are made to match the new search:
+	 * the baseline moves by the points of the move that was played, which
+	 * new paths no longer start with, and every chance node right under the
+	 * root takes the statistics of its child for the now known next piece,
+	 * which the old search drew at random.
+	 */
+	bool ReuseTree(const BitBoard& board, const int currentShape)
+	{
+		if (chosen_ < 0 || nodeCount_ > nodeCapacity_ * 3 / 4)
+		{
+			chosen_ = -1;
+			return false;
+		}
+
+		const Node& predicted = nodes_[chosen_];
+		chosen_ = -1;
+
+		if (predicted.expansion != kExpanded || predicted.board != board)
+		{
+			return false;
+		}
+
+		root_ = predicted.firstChild + currentShape;
+		Node& root = nodes_[root_];
+		if (root.piece != currentShape)
+		{
+			return false;
+		}
+
+		baseline_ -= kPointWeight * predicted.points;
+
+		auto visits = 0;
+		if (root.expansion == kExpanded)
+		{
+			for (auto i = 0; i < root.childCount; i++)
+			{
+				Node& chance = nodes_[root.firstChild + i];
+
+				//Rollouts from a leaf drew the next piece, only the known piece's subtree carries over
+				if (chance.expansion == kExpanded)
+				{
+					const Node& known = nodes_[chance.firstChild + known_[1]];
+					chance.visits = known.visits.load();
+					chance.rewardSum = known.rewardSum.load();
+				}
+				else
+				{
+					chance.visits = 0;
+					chance.rewardSum = 0;
+				}
+				visits += chance.visits;
+			}
+		}
+
+		root.visits = visits;
+		root.rewardSum = 0;
+		return true;
+	}
+
+	void Iterate(mt19937& random)
+	{
+		int32_t path[kMaxDepth + 2];
+		auto pathLength = 0;
+		auto depth = 0;
+		auto points = 0;
+		auto index = root_;
+
+		while (true)
+		{
+			Node& node = nodes_[index];
+			node.visits++;
+			path[pathLength++] = index;
+			points += node.points;
+
+			if (node.terminal)
+			{
+				Backpropagate(path, pathLength, 0.0);
+				return;
+			}
+
+			if (pathLength >= kMaxDepth || !Expand(node, index))
+			{
+				break;
+			}
+
+			if (node.kind == kChance)
+			{
+				const auto piece = depth < 2 ? known_[depth] : static_cast<int>(random() % PieceTable::kShapeCount);
+				index = node.firstChild + piece;
+				continue;
+			}
+
+			index = SelectChild(node);
+			depth++;
+		}
+
+		const Node& leaf = nodes_[index];
+		const auto reward = leaf.kind == kDecision
+			? Rollout(leaf.board, leaf.piece, depth, points, random)
+			: Rollout(leaf.board, -1, depth, points, random);
+
+		Backpropagate(path, pathLength, reward);
+	}
+
+	// Expands the node if nobody did yet, returns whether its children can be used.
+	bool Expand(Node& node, const int32_t index)
+	{
+		auto expansion = node.expansion.load(memory_order_acquire);
+		if (expansion == kExpanded)
+		{
+			return true;
+		}
+		if (expansion == kExpanding || !node.expansion.compare_exchange_strong(expansion, kExpanding))
+		{
+			return false;
+		}
+
+		//Rollout from a fresh leaf first, expand it once it has been visited
+		if (node.visits < 2 && index != root_)
+		{
+			node.expansion = kLeaf;
+			return false;
+		}
+
+		if (node.kind == kChance)
+		{
+			const auto first = Allocate(PieceTable::kShapeCount);
+			if (first < 0)
+			{
+				node.expansion = kLeaf;
+				return false;
+			}
+
+			for (auto piece = 0; piece < PieceTable::kShapeCount; piece++)
+			{
+				InitNode(first + piece, node.board, kDecision, piece);
+			}
+			node.firstChild = first;
+			node.childCount = PieceTable::kShapeCount;
+		}
+		else
+		{
+			Placement placements[BitBoard::kMaxPlacements];
+			const auto count = node.board.Placements(node.piece, placements);
+
+			if (count == 0)
+			{
+				node.terminal = true;
+				node.expansion = kLeaf;
+				return false;
+			}
+
+			const auto first = Allocate(count);
+			if (first < 0)
+			{
+				node.expansion = kLeaf;
+				return false;
+			}
+
+			for (auto i = 0; i < count; i++)
+			{
+				BitBoard child = node.board;
+				child.Place(node.piece, placements[i].rotation, placements[i].x, placements[i].y);
+				const auto lines = child.ClearLines();
+
+				InitNode(first + i, child, kChance, -1);
+				nodes_[first + i].move = placements[i];
+				nodes_[first + i].points = static_cast<int16_t>(LinePoints(lines, 0));
+			}
+			node.firstChild = first;
+			node.childCount = static_cast<int16_t>(count);
+		}
+
+		node.expansion.store(kExpanded, memory_order_release);
+		return true;
+	}
+
+	int32_t SelectChild(const Node& node) const
+	{
+		const auto logVisits = log(static_cast<double>(max(1, node.visits.load())));
+		auto bestScore = -1.0;
+		auto best = node.firstChild;
+
+		for (auto i = 0; i < node.childCount; i++)
+		{
+			const Node& child = nodes_[node.firstChild + i];
+			const auto visits = child.visits.load();
+
+			//Unvisited children first, in generation order
+			if (visits == 0)
+			{
+				return node.firstChild + i;
+			}
+
+			const auto mean = static_cast<double>(child.rewardSum.load()) / kRewardScale / visits;
+			const auto score = mean + kExploration * sqrt(logVisits / visits);
+
+			if (score > bestScore)
+			{
+				bestScore = score;
+				best = node.firstChild + i;
+			}
+		}
+
+		return best;
+	}
+
+	void Backpropagate(const int32_t* path, const int pathLength, const double reward)
+	{
+		const auto scaled = static_cast<long long>(reward * kRewardScale);
+
+		//Visits were counted on the way down, only the reward is still missing
+		for (auto i = 0; i < pathLength; i++)
+		{
+			nodes_[path[i]].rewardSum += scaled;
+		}
+	}
+
+	/**
+	 * Plays kRolloutDepth more pieces with the cheap policy and maps the final
+	 * board and the points on the way to a reward in [0, 1]. piece is the
+	 * shape to place first, -1 to draw it for the given depth.
+	 */
+	double Rollout(BitBoard board, int piece, int depth, int points, mt19937& random) const
+	{
+		auto combo = 0;
+
+		for (auto step = 0; step < kRolloutDepth; step++, depth++)
+		{
+			if (piece < 0)
+			{
+				piece = depth < 2 ? known_[depth] : static_cast<int>(random() % PieceTable::kShapeCount);
+			}
+
+			Placement placement = {};
+			if (!CheapPolicy(board, piece, random, placement))
+			{
+				return 0.0;
+			}
+
+			board.Place(piece, placement.rotation, placement.x, placement.y);
+			const auto lines = board.ClearLines();
+			combo = lines > 0 ? combo + 1 : 0;
+			points += LinePoints(lines, combo);
+			piece = -1;
+
+			//Garbage from the opponent and the periodic solid row
+			if (static_cast<int>(random() % 100) < kGarbagePercent && !board.PushRow(static_cast<int>(random() % board.width())))
+			{
+				return 0.0;
+			}
+			if ((round_ + depth + 1) % BitBoard::kRoundsPerSolidRow == 0 && !board.PushRow(-1))
+			{
+				return 0.0;
+			}
+		}
+
+		const auto value = EvaluateBoard(board, weights_) + kPointWeight * points - baseline_;
+		return 1.0 / (1.0 + exp(-value / kRewardSpread));
+	}
+
+	// Lowest landing that leaves the fewest gaps under the piece, random among equals.
+	static bool CheapPolicy(const BitBoard& board, const int piece, mt19937& random, Placement& chosen)
+	{
+		Placement placements[BitBoard::kMaxPlacements];
+		const auto count = board.Placements(piece, placements);
+		auto bestCost = 1 << 30;
+		auto ties = 0;
+
+		for (auto i = 0; i < count; i++)
+		{
+			const Placement& placement = placements[i];
+			const PieceTable::Orientation& orientation = PieceTable::Get(piece, placement.rotation);
+			auto gaps = 0;
+
+			for (auto dx = 0; dx < orientation.width; dx++)
+			{
+				gaps += board.ColumnTop(placement.x + dx) - 1 - (placement.y + orientation.bottom[dx]);
+			}
+
+			const auto cost = 4 * gaps + (board.height() - placement.y);
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				chosen = placement;
+				ties = 1;
+			}
+			else if (cost == bestCost && random() % ++ties == 0)
+			{
+				chosen = placement;
+			}
+		}
+
+		return count > 0;
+	}
+
+	// Row points of the game: nothing for a single, 3, 6 and 10 for more, plus the combo.
+	static int LinePoints(const int lines, const int combo)
+	{
+		static const int pointsPerLines[5] = { 0, 0, 3, 6, 10 };
+		return lines > 0 ? pointsPerLines[min(lines, 4)] + combo : 0;
+	}
+
+	const double kExploration = 0.6;
+	const double kPointWeight = 1.5;
+	const double kRewardSpread = 8.0;
+	const int kGarbagePercent = 15;
+
+	size_t nodeCapacity_;
+	unsigned int threadCount_;
+	unique_ptr<Node[]> nodes_;
+	atomic<size_t> nodeCount_{ 0 };
+	int32_t root_ = 0;
+	int32_t chosen_ = -1;
+
+	EvaluationWeights weights_;
+	double baseline_ = 0.0;
+	int known_[2] = { 0, 0 };
+	int round_ = 0;
+
+	//Helper searchers, woken once per search by a new generation
+	vector<thread> helpers_;
+	mutex mutex_;
+	condition_variable wakeHelpers_;
+	condition_variable helpersFinished_;
+	int generation_ = 0;
+	size_t helpersDone_ = 0;
+	bool stopping_ = false;
+	Clock::time_point deadline_;
+	atomic<long long> playouts_{ 0 };
+};
+
+#endif  // __MCTS_H
@@ -0,0 +1,145 @@
+#ifndef __MIRROR_H
+#define __MIRROR_H
+
+#include <cassert>
+#include <cstdint>
+
+#include "bit-board.h"
+#include "piece-table.h"
+
+using namespace std;
+
+/**
+ * Left to right reflection of game states. Reflecting the board turns J
+ * into L and S into Z while I, O and T map to themselves, and every
+ * placement into the placement covering the reflected cells, so a state
+ * and its mirror image have mirrored answers. Caches key on the canonical
+ * form, whichever of the two orders first, and reflect what they return
+ * back when the state they were asked about was the mirrored one. Moves
+ * are always built for the actual board, the spawn position is not
+ * symmetric.
+ */
+class Mirror {
+public:
+	// A state as a cache sees it, mirrored tells whether it is the reflection of the actual one.
+	struct State {
+		BitBoard board;
+		int currentShape;
+		int nextShape;
+		bool mirrored;
+	};
+
+	static int Shape(const int shape)
+	{
+		static const int shapes[PieceTable::kShapeCount] = { 0, 2, 1, 3, 6, 5, 4 };
+		return shapes[shape];
+	}
+
+	// Rotation of the mirrored shape whose cells are the reflected cells of the rotation.
+	static int Rotation(const int shape, const int rotation)
+	{
+		return Table().rotations[shape][rotation];
+	}
+
+	// Placement of the mirrored shape on the mirrored board of the given width, same anchor row.
+	static Placement Reflect(const int shape, const Placement& placement, const int width)
+	{
+		const auto rotation = Rotation(shape, placement.rotation);
+		const auto& orientation = PieceTable::Get(Shape(shape), rotation);
+		return Placement{ static_cast<int8_t>(rotation), static_cast<int8_t>(width - placement.x - orientation.width), placement.y };
+	}
+
+	/**
+	 * True when the reflection orders before the state itself: the first
+	 * row from the top that differs decides, then the current and the next
+	 * shape. Symmetric states are their own canonical form.
+	 */
+	static bool PrefersMirror(const BitBoard& board, const int currentShape, const int nextShape)
+	{
+		for (auto y = 0; y < board.height(); y++)
+		{
+			const auto row = board.Row(y);
+			const auto reversed = board.ReverseRow(row);
+
+			if (row != reversed)
+			{
+				return reversed < row;
+			}
+		}
+
+		if (Shape(currentShape) != currentShape)
+		{
+			return Shape(currentShape) < currentShape;
+		}
+
+		return Shape(nextShape) < nextShape;
+	}
+
+	static State Canonical(const BitBoard& board, const int currentShape, const int nextShape)
+	{
+		if (PrefersMirror(board, currentShape, nextShape))
+		{
+			return State{ board.Mirrored(), Shape(currentShape), Shape(nextShape), true };
+		}
+
+		return State{ board, currentShape, nextShape, false };
+	}
+
+private:
+	struct Rotations {
+		int rotations[PieceTable::kShapeCount][PieceTable::kMaxRotations];
+	};
+
+	static const Rotations& Table()
+	{
+		static const Rotations table = Build();
+		return table;
+	}
+
+	//Matches every orientation, reflected inside its own width, against the orientations of the mirrored shape
+	static Rotations Build()
+	{
+		Rotations table = {};
+
+		for (auto shape = 0; shape < PieceTable::kShapeCount; shape++)
+		{
+			for (auto rotation = 0; rotation < PieceTable::RotationCount(shape); rotation++)
+			{
+				const auto& orientation = PieceTable::Get(shape, rotation);
+				const auto reflected = CellMask(orientation, true);
+				auto found = false;
+
+				for (auto candidate = 0; candidate < PieceTable::RotationCount(Shape(shape)); candidate++)
+				{
+					if (CellMask(PieceTable::Get(Shape(shape), candidate), false) == reflected)
+					{
+						table.rotations[shape][rotation] = candidate;
+						found = true;
+						break;
+					}
+				}
+
+				assert(found);
+				(void)found;
+			}
+		}
+
+		return table;
+	}
+
+	//Cells as a 4x4 bit mask, one nibble per row
+	static uint32_t CellMask(const PieceTable::Orientation& orientation, const bool reflect)
+	{
+		uint32_t mask = 0;
+
+		for (const auto& cell : orientation.cells)
+		{
+			const auto column = reflect ? orientation.width - 1 - cell.dx : cell.dx;
+			mask |= 1u << (-cell.dy * 4 + column);
+		}
+
+		return mask;
+	}
+};
+
+#endif  // __MIRROR_H
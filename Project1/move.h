@@ -17,7 +17,10 @@ class Move {
   // LAST is only used to get the number of elements in this enum.
   enum MoveType { DOWN, LEFT, RIGHT, TURNLEFT, TURNRIGHT, DROP, LAST };
 
-  static string MoveToString(MoveType mt) {
+  static string MoveToString(MoveType mt) { return MoveName(mt); }
+
+  // Same names without building a string.
+  static const char* MoveName(MoveType mt) {
     switch (mt) {
       case DOWN:
         return "DOWN";
@@ -36,6 +39,32 @@ class Move {
     }
     return "UNKNOWN";
   }
+
+  // Reads the moves of a reply such as "TURNRIGHT,LEFT,DROP" from the first end characters of line,
+  // "no_moves" is none. Keeps the first maxMoves, returns how many or -1 for an unknown name.
+  static int ParseMoves(const string& line, const size_t end, MoveType* moves, const int maxMoves) {
+    int count = 0;
+
+    for (size_t start = 0; start < end;) {
+      size_t stop = line.find(',', start);
+      stop = stop < end ? stop : end;
+
+      bool known = false;
+      for (int move = 0; move < LAST && !known; move++) {
+        known = line.compare(start, stop - start, MoveName(static_cast<MoveType>(move))) == 0;
+        if (known && count < maxMoves) {
+          moves[count++] = static_cast<MoveType>(move);
+        }
+      }
+
+      if (!known && line.compare(start, stop - start, "no_moves") != 0) {
+        return -1;
+      }
+      start = stop + 1;
+    }
+
+    return count;
+  }
 };
 
 #endif  //__MOVE_H
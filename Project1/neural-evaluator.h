@@ -0,0 +1,311 @@
+#ifndef __NEURAL_EVALUATOR_H
+#define __NEURAL_EVALUATOR_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "bit-board.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define NEURAL_AVX2 __attribute__((target("avx2")))
+#define NEURAL_HAS_AVX2 1
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#define NEURAL_AVX2
+#define NEURAL_HAS_AVX2 1
+#else
+#define NEURAL_HAS_AVX2 0
+#endif
+
+using namespace std;
+
+/**
+ * Small int16-quantized value network: 32 board features, two hidden
+ * ReLU layers of 32 and one output. Weights come from a file written by
+ * the training pipeline:
+ *   "BBNN" magic, uint32 version, uint32 inputs, hidden1, hidden2,
+ *   uint32 shift1, shift2, float outputScale,
+ *   then for each layer int16 weights (row per neuron) and int32 biases.
+ * Accumulators are int32 and shifted back to int16 between layers.
+ * Load rejects neurons whose sum could leave the int32 range for any
+ * int16 inputs, and both paths add modulo 2^32 like the AVX2 adds.
+ * Inference runs in batches with AVX2 kernels when the CPU has them and
+ * a scalar path that gives bit-identical results otherwise.
+ */
+class NeuralEvaluator {
+public:
+	static const int kInputs = 32;
+	static const int kHidden1 = 32;
+	static const int kHidden2 = 32;
+
+	bool Load(const string& path)
+	{
+		ifstream in(path, ios::binary);
+		char magic[4];
+		uint32_t header[6];
+		float outputScale;
+
+		if (!in.read(magic, 4) || memcmp(magic, "BBNN", 4) != 0 ||
+			!in.read(reinterpret_cast<char*>(header), sizeof(header)) ||
+			!in.read(reinterpret_cast<char*>(&outputScale), sizeof(outputScale)))
+		{
+			cerr << "Unable to read network header from " << path << endl;
+			return false;
+		}
+
+		if (header[0] != kVersion || header[1] != kInputs || header[2] != kHidden1 || header[3] != kHidden2 ||
+			header[4] > 30 || header[5] > 30)
+		{
+			cerr << "Unsupported network layout in " << path << endl;
+			return false;
+		}
+
+		shift1_ = static_cast<int>(header[4]);
+		shift2_ = static_cast<int>(header[5]);
+		outputScale_ = outputScale;
+
+		if (!ReadArray(in, weights1_, sizeof(weights1_)) || !ReadArray(in, bias1_, sizeof(bias1_)) ||
+			!ReadArray(in, weights2_, sizeof(weights2_)) || !ReadArray(in, bias2_, sizeof(bias2_)) ||
+			!ReadArray(in, weights3_, sizeof(weights3_)) || !ReadArray(in, &bias3_, sizeof(bias3_)))
+		{
+			cerr << "Network file " << path << " is truncated" << endl;
+			return false;
+		}
+
+		if (!LayerFits(&weights1_[0][0], bias1_, kHidden1, kInputs) || !LayerFits(&weights2_[0][0], bias2_, kHidden2, kHidden1) ||
+			!LayerFits(weights3_, &bias3_, 1, kHidden2))
+		{
+			cerr << "Network weights in " << path << " can overflow the int32 accumulators" << endl;
+			return false;
+		}
+
+		loaded_ = true;
+		useAvx2_ = CpuHasAvx2();
+		return true;
+	}
+
+	bool IsLoaded() const { return loaded_; }
+
+	bool UsesAvx2() const { return useAvx2_; }
+
+	void ForceScalar() { useAvx2_ = false; }
+
+	static void ExtractFeatures(const BitBoard& board, int16_t* features)
+	{
+		const auto columns = min(board.width(), 10);
+		const auto columnMask = (1u << columns) - 1;
+		auto maxHeight = 0;
+
+		memset(features, 0, kInputs * sizeof(int16_t));
+
+		for (auto x = 0; x < columns; x++)
+		{
+			const auto height = board.ColumnHeight(x);
+			features[x] = static_cast<int16_t>(height);
+			maxHeight = max(maxHeight, height);
+
+			if (x > 0)
+			{
+				features[9 + x] = static_cast<int16_t>(height - board.ColumnHeight(x - 1));
+			}
+		}
+
+		//Holes per column, one row at a time: only the few hole bits are visited
+		uint32_t covered = 0;
+		auto completedLines = 0;
+
+		for (auto y = 0; y < board.height(); y++)
+		{
+			const auto row = board.Row(y);
+			auto holes = covered & ~row & columnMask;
+
+			while (holes != 0)
+			{
+				features[19 + CountTrailingZeros(holes)]++;
+				holes &= holes - 1;
+			}
+
+			covered |= row;
+			completedLines += row == board.FullRow() && y < board.height() - board.SolidRows() ? 1 : 0;
+		}
+
+		features[29] = static_cast<int16_t>(completedLines);
+		features[30] = static_cast<int16_t>(maxHeight);
+		features[31] = static_cast<int16_t>(board.SolidRows());
+	}
+
+	// Scores count boards into scores, higher is better like CalculateMoveScore.
+	void EvaluateBatch(const BitBoard* boards, const int count, double* scores) const
+	{
+		alignas(32) int16_t input[kBlock][kInputs];
+		alignas(32) int16_t hidden1[kBlock][kHidden1];
+		alignas(32) int16_t hidden2[kBlock][kHidden2];
+
+		for (auto start = 0; start < count; start += kBlock)
+		{
+			const auto blockSize = min(count - start, static_cast<int>(kBlock));
+
+			for (auto i = 0; i < blockSize; i++)
+			{
+				ExtractFeatures(boards[start + i], input[i]);
+			}
+
+			Layer(&weights1_[0][0], bias1_, kHidden1, &input[0][0], kInputs, blockSize, shift1_, &hidden1[0][0]);
+			Layer(&weights2_[0][0], bias2_, kHidden2, &hidden1[0][0], kHidden1, blockSize, shift2_, &hidden2[0][0]);
+
+			for (auto i = 0; i < blockSize; i++)
+			{
+				scores[start + i] = AddWrapped(DotScalar(weights3_, hidden2[i], kHidden2), bias3_) * static_cast<double>(outputScale_);
+			}
+		}
+	}
+
+private:
+	static const uint32_t kVersion = 1;
+	// Boards pushed through each layer together, the weights stay hot in L1 for the whole block.
+	static const int kBlock = 8;
+
+	static bool ReadArray(ifstream& in, void* data, const size_t bytes)
+	{
+		return static_cast<bool>(in.read(static_cast<char*>(data), bytes));
+	}
+
+	// Whether every neuron's weighted sum plus bias stays in int32 for any int16 inputs.
+	static bool LayerFits(const int16_t* weights, const int32_t* bias, const int outputs, const int inLength)
+	{
+		for (auto neuron = 0; neuron < outputs; neuron++)
+		{
+			int64_t bound = bias[neuron] < 0 ? -static_cast<int64_t>(bias[neuron]) : bias[neuron];
+			for (auto i = 0; i < inLength; i++)
+			{
+				const int64_t weight = weights[neuron * inLength + i];
+				bound += (weight < 0 ? -weight : weight) * 32768;
+			}
+
+			if (bound > INT32_MAX)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static int16_t Activate(const int32_t sum, const int shift)
+	{
+		return static_cast<int16_t>(min(32767, max(0, sum >> shift)));
+	}
+
+	// One dense ReLU layer for a block of inputs, rows of length inLength in and outputs out.
+	void Layer(const int16_t* weights, const int32_t* bias, const int outputs, const int16_t* in, const int inLength,
+		const int count, const int shift, int16_t* out) const
+	{
+#if NEURAL_HAS_AVX2
+		if (useAvx2_ && inLength == 32 && outputs % 8 == 0)
+		{
+			LayerAvx2(weights, bias, outputs, in, count, shift, out);
+			return;
+		}
+#endif
+		for (auto neuron = 0; neuron < outputs; neuron++)
+		{
+			for (auto i = 0; i < count; i++)
+			{
+				out[i * outputs + neuron] = Activate(AddWrapped(DotScalar(weights + neuron * inLength, in + i * inLength, inLength), bias[neuron]), shift);
+			}
+		}
+	}
+
+	//Summed modulo 2^32 like _mm256_madd_epi16 and _mm256_add_epi32, a single product always fits
+	static int32_t DotScalar(const int16_t* weights, const int16_t* values, const int length)
+	{
+		uint32_t sum = 0;
+		for (auto i = 0; i < length; i++)
+		{
+			sum += static_cast<uint32_t>(static_cast<int32_t>(weights[i]) * values[i]);
+		}
+		return static_cast<int32_t>(sum);
+	}
+
+	static int32_t AddWrapped(const int32_t a, const int32_t b)
+	{
+		return static_cast<int32_t>(static_cast<uint32_t>(a) + static_cast<uint32_t>(b));
+	}
+
+#if NEURAL_HAS_AVX2
+	// Layer with 32 inputs and a multiple of 8 outputs. Eight neurons are summed
+	// side by side and reduced together, so no horizontal add is paid per neuron.
+	NEURAL_AVX2 static void LayerAvx2(const int16_t* weights, const int32_t* bias, const int outputs, const int16_t* in,
+		const int count, const int shift, int16_t* out)
+	{
+		const __m128i shiftCount = _mm_cvtsi32_si128(shift);
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i limit = _mm256_set1_epi32(32767);
+		alignas(32) int32_t activated[8];
+
+		for (auto i = 0; i < count; i++)
+		{
+			const __m256i v0 = _mm256_load_si256(reinterpret_cast<const __m256i*>(in + i * 32));
+			const __m256i v1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(in + i * 32 + 16));
+
+			for (auto group = 0; group < outputs; group += 8)
+			{
+				__m256i sums[8];
+				for (auto j = 0; j < 8; j++)
+				{
+					const int16_t* row = weights + (group + j) * 32;
+					const __m256i w0 = _mm256_load_si256(reinterpret_cast<const __m256i*>(row));
+					const __m256i w1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(row + 16));
+					sums[j] = _mm256_add_epi32(_mm256_madd_epi16(w0, v0), _mm256_madd_epi16(w1, v1));
+				}
+
+				const __m256i pairs0 = _mm256_hadd_epi32(_mm256_hadd_epi32(sums[0], sums[1]), _mm256_hadd_epi32(sums[2], sums[3]));
+				const __m256i pairs1 = _mm256_hadd_epi32(_mm256_hadd_epi32(sums[4], sums[5]), _mm256_hadd_epi32(sums[6], sums[7]));
+				__m256i total = _mm256_add_epi32(_mm256_permute2x128_si256(pairs0, pairs1, 0x20),
+					_mm256_permute2x128_si256(pairs0, pairs1, 0x31));
+
+				total = _mm256_add_epi32(total, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bias + group)));
+				total = _mm256_min_epi32(_mm256_max_epi32(_mm256_sra_epi32(total, shiftCount), zero), limit);
+				_mm256_store_si256(reinterpret_cast<__m256i*>(activated), total);
+
+				for (auto j = 0; j < 8; j++)
+				{
+					out[i * outputs + group + j] = static_cast<int16_t>(activated[j]);
+				}
+			}
+		}
+	}
+
+	static bool CpuHasAvx2()
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		return __builtin_cpu_supports("avx2") != 0;
+#endif
+	}
+#else
+	static bool CpuHasAvx2() { return false; }
+#endif
+
+	alignas(32) int16_t weights1_[kHidden1][kInputs];
+	alignas(32) int16_t weights2_[kHidden2][kHidden1];
+	alignas(32) int16_t weights3_[kHidden2];
+	int32_t bias1_[kHidden1];
+	int32_t bias2_[kHidden2];
+	int32_t bias3_ = 0;
+	int shift1_ = 0;
+	int shift2_ = 0;
+	float outputScale_ = 1.0f;
+	bool loaded_ = false;
+	bool useAvx2_ = false;
+};
+
+#endif  // __NEURAL_EVALUATOR_H
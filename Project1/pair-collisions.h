@@ -0,0 +1,73 @@
+#ifndef __PAIR_COLLISIONS_H
+#define __PAIR_COLLISIONS_H
+
+#include <algorithm>
+#include <cstdint>
+
+#include "bit-board.h"
+#include "piece-table.h"
+
+using namespace std;
+
+/**
+ * Which placements of the next piece overlap a placement of the current
+ * piece, as rows of a bit matrix over the scan of the next piece. Every
+ * placement is a footprint, its cells as the four 16-bit row masks of
+ * PieceTable::Orientation::rows shifted to its column, and the row it
+ * rests on. Two footprints overlap when their rows are fewer than four
+ * apart and the masks, shifted onto the same rows, share a bit. A row of
+ * the matrix is one branch-free pass of ANDs over the footprints of the
+ * whole scan, against the first footprint shifted to each of the seven
+ * row distances beforehand. The pair search then only tests bits and
+ * never builds a board.
+ */
+class PairCollisions {
+public:
+	// Footprints of the next piece, bit i of every row stands for placements[i].
+	void SetSecond(const int shape, const Placement* placements, const int count)
+	{
+		count_ = count;
+		for (auto i = 0; i < count; i++)
+		{
+			cells_[i] = Cells(shape, placements[i]);
+			rows_[i] = placements[i].y;
+		}
+	}
+
+	// Bit i is set when placements[i] of the next piece overlaps the placement of the current one.
+	uint64_t Row(const int shape, const Placement& first) const
+	{
+		//The footprint of the current piece moved onto the rows of one resting up to three rows higher or lower, none further apart
+		const auto cells = Cells(shape, first);
+		uint64_t shifted[2 * kFootprintRows + 1] = {};
+
+		for (auto distance = 1 - kFootprintRows; distance < kFootprintRows; distance++)
+		{
+			shifted[distance + kFootprintRows] = distance >= 0 ? cells >> distance * PieceTable::kRowBits : cells << -distance * PieceTable::kRowBits;
+		}
+
+		const auto furthest = kFootprintRows;
+		uint64_t overlaps = 0;
+		for (auto i = 0; i < count_; i++)
+		{
+			const auto distance = min(max(first.y - rows_[i], -furthest), furthest);
+			overlaps |= static_cast<uint64_t>((shifted[distance + kFootprintRows] & cells_[i]) != 0) << i;
+		}
+
+		return overlaps;
+	}
+
+private:
+	static const int kFootprintRows = 4;
+
+	static uint64_t Cells(const int shape, const Placement& placement)
+	{
+		return PieceTable::Get(shape, placement.rotation).rows << placement.x;
+	}
+
+	int count_ = 0;
+	uint64_t cells_[BitBoard::kMaxPlacements];
+	int rows_[BitBoard::kMaxPlacements];
+};
+
+#endif  // __PAIR_COLLISIONS_H
@@ -0,0 +1,407 @@
+#ifndef __PATTERN_CACHE_H
+#define __PATTERN_CACHE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+
+#include "bot-config.h"
+#include "field.h"
+#include "mirror.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/**
+ * Best placements for surface patterns, kept in a memory-mapped file so
+ * they survive across games and runs.
+ * The key is the height difference between neighbouring columns plus the
+ * current and next piece, and every entry also holds the field size and
+ * the height of the lowest column. Without buried holes the rows below
+ * that are solid, so together they are the whole board and the entry is
+ * the answer of the pair search for exactly this state. Boards with a
+ * step the key cannot hold or wider than kMaxKeyWidth are not cached.
+ * The file header holds a fingerprint of the evaluator, a file filled
+ * under another one is refused.
+ * A surface and its mirror image share one entry, see Mirror.
+ * Entries live in 4-way buckets, a full bucket evicts its least recently
+ * used entry. Sharing the file between processes is not synchronised.
+ */
+class PatternCache {
+public:
+	struct Entry {
+		uint64_t key;
+		float score;
+		uint32_t stamp;
+		int8_t rotation;
+		int8_t xPosition;
+		uint8_t width;
+		uint8_t height;
+		uint8_t floor;
+		uint8_t padding[3];
+	};
+
+	// What an entry is looked up by, mirrored tells whether the key is the one of the reflected state.
+	struct Pattern {
+		uint64_t key;
+		uint8_t width;
+		uint8_t height;
+		uint8_t floor;
+		bool mirrored;
+	};
+
+	PatternCache() {}
+
+	~PatternCache() { Close(); }
+
+	PatternCache(const PatternCache&) = delete;
+	PatternCache& operator=(const PatternCache&) = delete;
+
+	//Maps the cache file, creating or resetting it if it does not match the requested size, see Fingerprint
+	bool Open(const string& path, const size_t sizeMb, const uint64_t fingerprint)
+	{
+		const size_t bucketCount = max<size_t>(1, sizeMb * 1024 * 1024 / (sizeof(Entry) * kWays));
+		const size_t bytes = sizeof(Header) + bucketCount * kWays * sizeof(Entry);
+
+		if (!Map(path, bytes))
+		{
+			cerr << "Unable to map pattern cache " << path << endl;
+			return false;
+		}
+
+		if (m_header->magic != kMagic || m_header->version != kVersion || m_header->bucketCount != bucketCount)
+		{
+			memset(m_base, 0, bytes);
+			m_header->magic = kMagic;
+			m_header->version = kVersion;
+			m_header->bucketCount = bucketCount;
+			m_header->fingerprint = fingerprint;
+		}
+		else if (m_header->fingerprint != fingerprint)
+		{
+			cerr << "Pattern cache " << path << " was filled with another evaluator" << endl;
+			Close();
+			return false;
+		}
+
+		m_entries = reinterpret_cast<Entry*>(m_base + sizeof(Header));
+		return true;
+	}
+
+	bool IsOpen() const { return m_entries != nullptr; }
+
+	//Only boards without buried holes are described by their surface, and only steps and widths the key holds
+	static bool Cacheable(const Field& field)
+	{
+		if (field.width() > kMaxKeyWidth || field.HoleCount() != 0)
+		{
+			return false;
+		}
+
+		for (auto x = 1; x < field.width(); x++)
+		{
+			const auto step = field.ColumnHeight(x) - field.ColumnHeight(x - 1);
+			if (step > kMaxStep || step < -kMaxStep)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * Hash of everything besides the board that decides the pair search:
+	 * the evaluator preset and the contents of the network and weight set
+	 * files, with the way the sets are combined.
+	 */
+	static uint64_t Fingerprint(const BotConfig& config)
+	{
+		auto hash = HashText(kFnvOffset, config.evaluator);
+
+		if (!config.neuralWeightsPath.empty())
+		{
+			hash = HashText(hash, ReadFile(config.neuralWeightsPath));
+		}
+
+		if (!config.ensemblePath.empty())
+		{
+			hash = HashText(HashText(hash, ReadFile(config.ensemblePath)), config.ensembleCombine);
+		}
+
+		return hash;
+	}
+
+	/**
+	 * Pattern of the canonical form of a cacheable board and both shapes,
+	 * see Mirror::Canonical. Entries of a mirrored pattern hold the
+	 * placement on the mirrored board, see Mirror::Reflect.
+	 */
+	static Pattern Key(const Field& field, const int currentShape, const int nextShape)
+	{
+		const auto canonical = Mirror::Canonical(field.Board(), currentShape, nextShape);
+		const BitBoard& board = canonical.board;
+
+		uint64_t key = 0;
+		auto floor = board.height();
+		for (auto x = 0; x < board.width(); x++)
+		{
+			if (x > 0)
+			{
+				key = (key << kStepBits) | Step(board.ColumnHeight(x) - board.ColumnHeight(x - 1));
+			}
+			floor = min(floor, board.ColumnHeight(x));
+		}
+
+		key = (key << kShapeBits) | static_cast<uint64_t>(canonical.currentShape);
+		key = (key << kShapeBits) | static_cast<uint64_t>(canonical.nextShape);
+
+		//Zero marks an empty slot
+		return Pattern{ key + 1, static_cast<uint8_t>(board.width()), static_cast<uint8_t>(board.height()), static_cast<uint8_t>(floor),
+			canonical.mirrored };
+	}
+
+	bool Lookup(const Pattern& pattern, Entry& result)
+	{
+		lock_guard<mutex> lock(m_mutex);
+		Entry* bucket = Bucket(pattern);
+
+		for (auto i = 0; i < kWays; i++)
+		{
+			if (Matches(bucket[i], pattern))
+			{
+				bucket[i].stamp = ++m_header->clock;
+				result = bucket[i];
+				m_hits++;
+				return true;
+			}
+		}
+
+		m_misses++;
+		return false;
+	}
+
+	void Store(const Pattern& pattern, const int rotation, const int xPosition, const double score)
+	{
+		lock_guard<mutex> lock(m_mutex);
+		Entry* bucket = Bucket(pattern);
+		Entry* victim = &bucket[0];
+
+		for (auto i = 0; i < kWays; i++)
+		{
+			if (Matches(bucket[i], pattern) || bucket[i].key == 0)
+			{
+				victim = &bucket[i];
+				break;
+			}
+
+			if (bucket[i].stamp < victim->stamp)
+			{
+				victim = &bucket[i];
+			}
+		}
+
+		victim->score = static_cast<float>(score);
+		victim->stamp = ++m_header->clock;
+		victim->rotation = static_cast<int8_t>(rotation);
+		victim->xPosition = static_cast<int8_t>(xPosition);
+		victim->width = pattern.width;
+		victim->height = pattern.height;
+		victim->floor = pattern.floor;
+		victim->key = pattern.key;
+	}
+
+	long long Hits() const { return m_hits; }
+
+	long long Misses() const { return m_misses; }
+
+private:
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t bucketCount;
+		uint64_t fingerprint;
+		uint32_t clock;
+		uint8_t padding[4];
+	};
+
+	static const uint32_t kMagic = 0x50434242;
+	static const uint32_t kVersion = 4;
+	static const int kWays = 4;
+	static const int kStepBits = 4;
+	static const int kShapeBits = 3;
+	// Steps from -kMaxStep to kMaxStep fill a nibble.
+	static const int kMaxStep = 7;
+	// The widest board whose steps and shapes fit the key next to the empty slot marker.
+	static const int kMaxKeyWidth = 15;
+	static const uint64_t kFnvOffset = 0xCBF29CE484222325ULL;
+
+	static_assert(2 * kMaxStep < 1 << kStepBits, "a step does not fit its bits");
+	static_assert((kMaxKeyWidth - 1) * kStepBits + 2 * kShapeBits < 64, "the key of the widest board does not fit 64 bits");
+
+	//Height difference of a cacheable board as a nibble
+	static uint64_t Step(const int difference)
+	{
+		return static_cast<uint64_t>(difference + kMaxStep);
+	}
+
+	static bool Matches(const Entry& entry, const Pattern& pattern)
+	{
+		return entry.key == pattern.key && entry.width == pattern.width && entry.height == pattern.height && entry.floor == pattern.floor;
+	}
+
+	Entry* Bucket(const Pattern& pattern) const
+	{
+		//Fibonacci hashing spreads the packed nibbles and the board size over all buckets
+		const auto size = static_cast<uint64_t>(pattern.width) << 16 | static_cast<uint64_t>(pattern.height) << 8 | pattern.floor;
+		const auto hash = (pattern.key ^ size * 0xC2B2AE3D27D4EB4FULL) * 0x9E3779B97F4A7C15ULL;
+		return m_entries + (hash >> 16) % m_header->bucketCount * kWays;
+	}
+
+	//FNV-1a over the text and its length, so neighbouring texts do not run into each other
+	static uint64_t HashText(uint64_t hash, const string& text)
+	{
+		for (const auto c : text)
+		{
+			hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001B3ULL;
+		}
+
+		return (hash ^ text.size()) * 0x100000001B3ULL;
+	}
+
+	//Contents of the file, empty when it cannot be read
+	static string ReadFile(const string& path)
+	{
+		ifstream in(path, ios::binary);
+		return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+	}
+
+#ifdef _WIN32
+	bool Map(const string& path, const size_t bytes)
+	{
+		m_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+			nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE,
+			static_cast<DWORD>(static_cast<uint64_t>(bytes) >> 32), static_cast<DWORD>(bytes), nullptr);
+		if (m_mapping == nullptr)
+		{
+			Close();
+			return false;
+		}
+
+		m_base = static_cast<char*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes));
+		if (m_base == nullptr)
+		{
+			Close();
+			return false;
+		}
+
+		m_header = reinterpret_cast<Header*>(m_base);
+		return true;
+	}
+
+	void Close()
+	{
+		if (m_base != nullptr)
+		{
+			UnmapViewOfFile(m_base);
+		}
+		if (m_mapping != nullptr)
+		{
+			CloseHandle(m_mapping);
+		}
+		if (m_file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(m_file);
+		}
+
+		m_base = nullptr;
+		m_mapping = nullptr;
+		m_file = INVALID_HANDLE_VALUE;
+		m_header = nullptr;
+		m_entries = nullptr;
+	}
+
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = nullptr;
+#else
+	bool Map(const string& path, const size_t bytes)
+	{
+		m_fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		if (m_fd < 0)
+		{
+			return false;
+		}
+
+		struct stat info;
+		if (fstat(m_fd, &info) != 0 || (static_cast<size_t>(info.st_size) != bytes && ftruncate(m_fd, bytes) != 0))
+		{
+			Close();
+			return false;
+		}
+
+		void* base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+		if (base == MAP_FAILED)
+		{
+			Close();
+			return false;
+		}
+
+		m_base = static_cast<char*>(base);
+		m_bytes = bytes;
+		m_header = reinterpret_cast<Header*>(m_base);
+		return true;
+	}
+
+	void Close()
+	{
+		if (m_base != nullptr)
+		{
+			munmap(m_base, m_bytes);
+		}
+		if (m_fd >= 0)
+		{
+			close(m_fd);
+		}
+
+		m_base = nullptr;
+		m_fd = -1;
+		m_header = nullptr;
+		m_entries = nullptr;
+	}
+
+	int m_fd = -1;
+	size_t m_bytes = 0;
+#endif
+
+	char* m_base = nullptr;
+	Header* m_header = nullptr;
+	Entry* m_entries = nullptr;
+
+	mutex m_mutex;
+	long long m_hits = 0;
+	long long m_misses = 0;
+};
+
+#endif  // __PATTERN_CACHE_H
@@ -0,0 +1,599 @@
+#ifndef __PERFT_H
+#define __PERFT_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "bit-board.h"
+#include "field.h"
+#include "move.h"
+#include "shape.h"
+#include "worker-pool.h"
+
+using namespace std;
+
+/**
+ * Perft for placements: walks every sequence of lock positions for a
+ * piece sequence and counts them per depth. Lock positions come from a
+ * search over the real moves (left, right, down and both turns from the
+ * spawn position), so they are exactly what the engine lets a piece reach.
+ * Next to them it counts what the straight-drop generator used by
+ * GetMoves finds and how many reachable locks it misses, e.g. tucks under
+ * overhangs. Boards are merged after every depth, so counts are of
+ * distinct boards rather than of move sequences.
+ */
+class Perft {
+public:
+	struct DepthCounts {
+		// Boards the depth started from.
+		long long frontier = 0;
+		// Reachable lock positions summed over those boards.
+		long long positions = 0;
+		// Placements of the straight-drop generator summed over the boards.
+		long long dropPlacements = 0;
+		// Reachable locks the straight-drop generator does not produce.
+		long long missedByDrop = 0;
+		// Locks that leave cells above the field, these end the game.
+		long long topOuts = 0;
+		// Distinct boards after the locks and line clears.
+		long long boards = 0;
+		double seconds = 0.0;
+	};
+
+	Perft()
+	{
+		BuildBoxes();
+	}
+
+	// Counts depth by depth, piece i of the sequence is placed at depth i + 1.
+	vector<DepthCounts> Run(const BitBoard& root, const vector<int>& pieces, const int depth, WorkerPool& pool) const
+	{
+		vector<DepthCounts> results;
+		vector<BitBoard> frontier(1, root);
+
+		for (auto d = 0; d < depth && d < static_cast<int>(pieces.size()) && !frontier.empty(); d++)
+		{
+			const auto started = chrono::steady_clock::now();
+			const auto shape = pieces[d];
+			const auto ranges = static_cast<int>(min(frontier.size(), pool.size() * kRangesPerWorker));
+
+			DepthCounts counts;
+			counts.frontier = static_cast<long long>(frontier.size());
+
+			mutex merge;
+			unordered_set<BitBoard, BoardHash> next;
+
+			pool.ParallelFor(0, 0, ranges, [&](const int range) {
+				DepthCounts local;
+				vector<BitBoard> children;
+				Placement locks[kMaxLocks];
+
+				const auto first = frontier.size() * range / ranges;
+				const auto last = frontier.size() * (range + 1) / ranges;
+
+				for (auto i = first; i < last; i++)
+				{
+					const BitBoard& board = frontier[i];
+					auto topOuts = 0;
+					const auto lockCount = ReachableLocks(board, shape, locks, topOuts);
+
+					Placement drops[BitBoard::kMaxPlacements];
+					const auto dropCount = board.Placements(shape, drops);
+
+					local.positions += lockCount + topOuts;
+					local.topOuts += topOuts;
+					local.dropPlacements += dropCount;
+
+					for (auto j = 0; j < lockCount; j++)
+					{
+						if (!Contains(drops, dropCount, locks[j]))
+						{
+							local.missedByDrop++;
+						}
+
+						BitBoard child = board;
+						child.Place(shape, locks[j].rotation, locks[j].x, locks[j].y);
+						child.ClearLines();
+						children.push_back(child);
+					}
+				}
+
+				lock_guard<mutex> lock(merge);
+				counts.positions += local.positions;
+				counts.topOuts += local.topOuts;
+				counts.dropPlacements += local.dropPlacements;
+				counts.missedByDrop += local.missedByDrop;
+				next.insert(children.begin(), children.end());
+			});
+
+			frontier.assign(next.begin(), next.end());
+			counts.boards = static_cast<long long>(frontier.size());
+			counts.seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+			results.push_back(counts);
+		}
+
+		return results;
+	}
+
+	/**
+	 * Writes the lock positions reachable from the spawn position to out and
+	 * returns how many there are. Locks sticking out of the top of the field
+	 * are only counted in topOuts.
+	 */
+	int ReachableLocks(const BitBoard& board, const int shape, Placement* out, int& topOuts) const
+	{
+		const Box& box = boxes_[shape];
+		const auto spawnX = (board.width() - box.size) / 2;
+
+		//Box origins range from size - 1 columns left of the field to its right edge, and from the spawn row down
+		const auto columns = board.width() + kMaxBox;
+		const auto rows = board.height() + kMaxBox;
+		bool seen[kTurns * (BitBoard::kMaxWidth + kMaxBox) * (BitBoard::kMaxHeight + kMaxBox)] = {};
+		bool locked[PieceTable::kMaxRotations][BitBoard::kMaxWidth][BitBoard::kMaxHeight] = {};
+
+		auto count = 0;
+		topOuts = 0;
+
+		struct State {
+			int turn;
+			int x;
+			int y;
+		};
+		State stack[sizeof(seen)];
+		auto stackSize = 0;
+
+		const auto visit = [&](const State& state) {
+			if (!BoxFits(board, box, state.turn, state.x, state.y))
+			{
+				return;
+			}
+			auto& flag = seen[(state.turn * columns + state.x + kMaxBox) * rows + state.y + 1];
+			if (!flag)
+			{
+				flag = true;
+				stack[stackSize++] = state;
+			}
+		};
+
+		visit(State{ 0, spawnX, kSpawnY });
+
+		while (stackSize > 0)
+		{
+			const auto state = stack[--stackSize];
+
+			visit(State{ state.turn, state.x - 1, state.y });
+			visit(State{ state.turn, state.x + 1, state.y });
+			visit(State{ (state.turn + 1) % kTurns, state.x, state.y });
+			visit(State{ (state.turn + kTurns - 1) % kTurns, state.x, state.y });
+
+			if (BoxFits(board, box, state.turn, state.x, state.y + 1))
+			{
+				visit(State{ state.turn, state.x, state.y + 1 });
+				continue;
+			}
+
+			//Cannot move down any more, the piece locks here
+			const Lock& lock = box.locks[state.turn];
+			const auto x = state.x + lock.dx;
+			const auto y = state.y + lock.dy;
+
+			if (y - (PieceTable::Get(shape, lock.rotation).height - 1) < 0)
+			{
+				topOuts++;
+			}
+			else if (!locked[lock.rotation][x][y])
+			{
+				locked[lock.rotation][x][y] = true;
+				out[count].rotation = static_cast<int8_t>(lock.rotation);
+				out[count].x = static_cast<int8_t>(x);
+				out[count].y = static_cast<int8_t>(y);
+				count++;
+			}
+		}
+
+		return count;
+	}
+
+	/**
+	 * Lock positions the legacy generator accepts on a field, that is
+	 * CheckValidShapePosition resting on a block or the floor. Only usable on
+	 * the root, deeper boards have no Field.
+	 */
+	static int LegacyLocks(Field field, const int shape, Placement* out)
+	{
+		auto count = 0;
+
+		for (auto rotation = 0; rotation < PieceTable::RotationCount(shape); rotation++)
+		{
+			for (auto x = 0; x < field.width(); x++)
+			{
+				for (auto y = 0; y < field.height(); y++)
+				{
+					double score;
+					if (field.CheckValidShapePosition(shape, rotation, x, y, score) && !field.Board().Fits(shape, rotation, x, y + 1))
+					{
+						out[count].rotation = static_cast<int8_t>(rotation);
+						out[count].x = static_cast<int8_t>(x);
+						out[count].y = static_cast<int8_t>(y);
+						count++;
+					}
+				}
+			}
+		}
+
+		return count;
+	}
+
+	static bool Contains(const Placement* placements, const int count, const Placement& placement)
+	{
+		for (auto i = 0; i < count; i++)
+		{
+			if (placements[i].rotation == placement.rotation && placements[i].x == placement.x && placements[i].y == placement.y)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+	 * Plays the moves from the spawn position like the engine: a move that
+	 * does not fit is ignored and the piece drops once the moves run out.
+	 * Returns false when the piece does not fit at the spawn position or
+	 * locks sticking out of the top, either loses the game.
+	 */
+	bool Play(const BitBoard& board, const int shape, const Move::MoveType* moves, const int count, Placement& placement) const
+	{
+		const Box& box = boxes_[shape];
+		auto turn = 0;
+		auto x = (board.width() - box.size) / 2;
+		auto y = kSpawnY;
+
+		if (!BoxFits(board, box, turn, x, y))
+		{
+			return false;
+		}
+
+		for (auto i = 0; i < count; i++)
+		{
+			switch (moves[i])
+			{
+			case Move::LEFT:
+				x -= BoxFits(board, box, turn, x - 1, y) ? 1 : 0;
+				break;
+			case Move::RIGHT:
+				x += BoxFits(board, box, turn, x + 1, y) ? 1 : 0;
+				break;
+			case Move::DOWN:
+				y += BoxFits(board, box, turn, x, y + 1) ? 1 : 0;
+				break;
+			case Move::TURNLEFT:
+				turn = BoxFits(board, box, (turn + kTurns - 1) % kTurns, x, y) ? (turn + kTurns - 1) % kTurns : turn;
+				break;
+			case Move::TURNRIGHT:
+				turn = BoxFits(board, box, (turn + 1) % kTurns, x, y) ? (turn + 1) % kTurns : turn;
+				break;
+			default:
+				break;
+			}
+		}
+
+		while (BoxFits(board, box, turn, x, y + 1))
+		{
+			y++;
+		}
+
+		const Lock& lock = box.locks[turn];
+		placement.rotation = static_cast<int8_t>(lock.rotation);
+		placement.x = static_cast<int8_t>(x + lock.dx);
+		placement.y = static_cast<int8_t>(y + lock.dy);
+
+		return placement.y - (PieceTable::Get(shape, lock.rotation).height - 1) >= 0;
+	}
+
+	// Field cells of the piece at the spawn position, cells above the field have y < 0.
+	void SpawnCells(const int width, const int shape, PieceTable::Offset* cells) const
+	{
+		const Box& box = boxes_[shape];
+		const auto x = (width - box.size) / 2;
+
+		for (auto i = 0; i < 4; i++)
+		{
+			cells[i] = PieceTable::Offset{ x + box.cells[0][i].dx, kSpawnY + box.cells[0][i].dy };
+		}
+	}
+
+	// Appends the field as the engine sends it, solid rows, blocks and the shape at the spawn position.
+	void AppendField(const BitBoard& board, const int shape, string& out) const
+	{
+		PieceTable::Offset spawn[4];
+		SpawnCells(board.width(), shape, spawn);
+
+		for (auto y = 0; y < board.height(); y++)
+		{
+			for (auto x = 0; x < board.width(); x++)
+			{
+				auto cell = y >= board.height() - board.SolidRows() ? '3' : (board.IsOccupied(x, y) ? '2' : '0');
+				for (const auto& spawnCell : spawn)
+				{
+					cell = spawnCell.dx == x && spawnCell.dy == y && cell == '0' ? '1' : cell;
+				}
+
+				out += cell;
+				if (x + 1 < board.width())
+				{
+					out += ',';
+				}
+			}
+
+			if (y + 1 < board.height())
+			{
+				out += ';';
+			}
+		}
+	}
+
+	static const int kMaxLocks = PieceTable::kMaxRotations * BitBoard::kMaxWidth * BitBoard::kMaxHeight;
+
+private:
+	static const int kTurns = 4;
+	static const int kMaxBox = 4;
+	// Row of the box origin when a piece enters the field.
+	static const int kSpawnY = -1;
+	static const size_t kRangesPerWorker = 4;
+
+	// Anchor of the PieceTable orientation relative to the box origin.
+	struct Lock {
+		int rotation;
+		int dx;
+		int dy;
+	};
+
+	// A piece in its rotation box, cells as (x, y) from the box origin per number of right turns.
+	struct Box {
+		int size;
+		PieceTable::Offset cells[kTurns][4];
+		Lock locks[kTurns];
+	};
+
+	struct BoardHash {
+		size_t operator()(const BitBoard& board) const { return static_cast<size_t>(board.Hash()); }
+	};
+
+	static bool BoxFits(const BitBoard& board, const Box& box, const int turn, const int x, const int y)
+	{
+		for (const auto& cell : box.cells[turn])
+		{
+			const auto cellX = x + cell.dx;
+			const auto cellY = y + cell.dy;
+
+			//Cells above the field are allowed while the piece enters
+			if (cellX < 0 || cellX >= board.width() || cellY >= board.height() || (cellY >= 0 && board.IsOccupied(cellX, cellY)))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * Rotation boxes as laid out by Shape::SetShape, shape_[row][column],
+	 * turned right the way Shape::TurnRight does. Each turn is matched to
+	 * the PieceTable orientation with the same cells.
+	 */
+	void BuildBoxes()
+	{
+		static const PieceTable::Offset spawns[PieceTable::kShapeCount][4] = {
+			{ { 0, 1 }, { 1, 1 }, { 2, 1 }, { 3, 1 } },
+			{ { 0, 0 }, { 0, 1 }, { 1, 1 }, { 2, 1 } },
+			{ { 2, 0 }, { 0, 1 }, { 1, 1 }, { 2, 1 } },
+			{ { 0, 0 }, { 1, 0 }, { 0, 1 }, { 1, 1 } },
+			{ { 1, 0 }, { 2, 0 }, { 0, 1 }, { 1, 1 } },
+			{ { 1, 0 }, { 0, 1 }, { 1, 1 }, { 2, 1 } },
+			{ { 0, 0 }, { 1, 0 }, { 1, 1 }, { 2, 1 } },
+		};
+
+		for (auto shape = 0; shape < PieceTable::kShapeCount; shape++)
+		{
+			Box& box = boxes_[shape];
+			box.size = PieceTable::BoxSize(shape);
+
+			for (auto i = 0; i < 4; i++)
+			{
+				box.cells[0][i] = spawns[shape][i];
+			}
+
+			for (auto turn = 1; turn < kTurns; turn++)
+			{
+				for (auto i = 0; i < 4; i++)
+				{
+					const auto& previous = box.cells[turn - 1][i];
+					box.cells[turn][i] = PieceTable::Offset{ box.size - 1 - previous.dy, previous.dx };
+				}
+			}
+
+			for (auto turn = 0; turn < kTurns; turn++)
+			{
+				box.locks[turn] = MatchOrientation(shape, box.cells[turn]);
+			}
+		}
+	}
+
+	static Lock MatchOrientation(const int shape, const PieceTable::Offset (&cells)[4])
+	{
+		auto left = cells[0].dx;
+		auto bottom = cells[0].dy;
+		for (const auto& cell : cells)
+		{
+			left = min(left, cell.dx);
+			bottom = max(bottom, cell.dy);
+		}
+
+		for (auto rotation = 0; rotation < PieceTable::RotationCount(shape); rotation++)
+		{
+			auto matches = 0;
+			for (const auto& cell : cells)
+			{
+				for (const auto& offset : PieceTable::Get(shape, rotation).cells)
+				{
+					matches += cell.dx - left == offset.dx && cell.dy - bottom == offset.dy ? 1 : 0;
+				}
+			}
+
+			if (matches == 4)
+			{
+				return Lock{ rotation, left, bottom };
+			}
+		}
+
+		assert(false);
+		return Lock{ 0, left, bottom };
+	}
+
+	Box boxes_[PieceTable::kShapeCount];
+};
+
+/**
+ * Known-answer files for Perft, one position per file:
+ *   width 10
+ *   height 20
+ *   field 0,0,...;...      optional, engine format, empty field otherwise
+ *   pieces TIO             one letter per depth
+ *   depth 1 34 34          optional expected positions and boards per depth
+ * Lines starting with # are comments. Without expectations the counts are
+ * only printed, with them any difference fails the run.
+ */
+class PerftRunner {
+public:
+	static int Run(const string& path, const int maxDepth, WorkerPool& pool)
+	{
+		ifstream in(path);
+		if (!in)
+		{
+			cerr << "Unable to open perft file " << path << endl;
+			return 1;
+		}
+
+		auto width = 10;
+		auto height = 20;
+		string fieldString;
+		vector<int> pieces;
+		vector<pair<long long, long long>> expected;
+
+		string line;
+		while (getline(in, line))
+		{
+			istringstream words(line);
+			string key;
+			words >> key;
+
+			if (key.empty() || key[0] == '#')
+			{
+				continue;
+			}
+			if (key == "width")
+			{
+				words >> width;
+			}
+			else if (key == "height")
+			{
+				words >> height;
+			}
+			else if (key == "field")
+			{
+				words >> fieldString;
+			}
+			else if (key == "pieces")
+			{
+				string letters;
+				words >> letters;
+				for (const auto letter : letters)
+				{
+					pieces.push_back(Shape::StringToShapeType(string(1, letter)));
+				}
+			}
+			else if (key == "depth")
+			{
+				int depth;
+				long long positions, boards;
+				words >> depth >> positions >> boards;
+				expected.resize(max<size_t>(expected.size(), depth));
+				expected[depth - 1] = make_pair(positions, boards);
+			}
+			else
+			{
+				cerr << "Cannot parse perft line: " << line << endl;
+				return 1;
+			}
+		}
+
+		if (width > BitBoard::kMaxWidth || height > BitBoard::kMaxHeight || pieces.empty() ||
+			find(pieces.begin(), pieces.end(), static_cast<int>(Shape::NONE)) != pieces.end())
+		{
+			cerr << "Perft file " << path << " needs a supported field size and a piece sequence" << endl;
+			return 1;
+		}
+
+		if (fieldString.empty())
+		{
+			for (auto y = 0; y < height; y++)
+			{
+				for (auto x = 0; x < width; x++)
+				{
+					fieldString += x == 0 ? (y == 0 ? "0" : ";0") : ",0";
+				}
+			}
+		}
+
+		const Field field(width, height, fieldString);
+		const auto depth = maxDepth > 0 ? maxDepth : static_cast<int>(expected.empty() ? pieces.size() : expected.size());
+
+		Perft perft;
+		auto failed = false;
+
+		//The legacy generator only works on a Field, so it is compared on the root alone
+		Placement legacy[Perft::kMaxLocks];
+		Placement reachable[Perft::kMaxLocks];
+		auto topOuts = 0;
+		const auto legacyCount = Perft::LegacyLocks(field, pieces[0], legacy);
+		const auto reachableCount = perft.ReachableLocks(field.Board(), pieces[0], reachable, topOuts);
+		auto legacyUnreachable = 0;
+		for (auto i = 0; i < legacyCount; i++)
+		{
+			legacyUnreachable += Perft::Contains(reachable, reachableCount, legacy[i]) ? 0 : 1;
+		}
+		cout << "root: " << reachableCount << " reachable locks, legacy generator " << legacyCount << " of which "
+			<< legacyUnreachable << " unreachable" << endl;
+
+		const auto results = perft.Run(field.Board(), pieces, depth, pool);
+
+		for (size_t d = 0; d < results.size(); d++)
+		{
+			const auto& counts = results[d];
+			cout << "depth " << d + 1 << ": " << counts.positions << " positions, " << counts.boards << " boards, "
+				<< counts.dropPlacements << " drops, " << counts.missedByDrop << " missed by drops, "
+				<< counts.topOuts << " top-outs, " << static_cast<long long>(counts.positions / max(counts.seconds, 1e-9))
+				<< " positions/s";
+
+			if (d < expected.size() && expected[d].first > 0 &&
+				(expected[d].first != counts.positions || expected[d].second != counts.boards))
+			{
+				cout << "  MISMATCH, expected " << expected[d].first << " positions, " << expected[d].second << " boards";
+				failed = true;
+			}
+			cout << endl;
+		}
+
+		return failed ? 1 : 0;
+	}
+};
+
+#endif  // __PERFT_H
@@ -0,0 +1,360 @@
+#ifndef __PHASE_PROFILER_H
+#define __PHASE_PROFILER_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/**
+ * Hardware counters around the search phases of GetMoves: cycles,
+ * instructions, L1 data and last level cache misses and branch misses of
+ * the searching thread, read with perf_event_open as one group. Where the
+ * kernel refuses them, or off Linux, only the wall time is kept. Counts
+ * add up per action and per game and go to the report file as JSON lines
+ * once the game is over, so profiling does no I/O while the clock runs.
+ * Placements are scored inside the scan phase, one read per scored
+ * placement would cost more than the scoring.
+ */
+class PhaseProfiler {
+public:
+	enum Phase {
+		// Placements of a piece scored on the field, Field::CalculateMoveScore or an evaluator.
+		SCAN,
+		// Scored placements sorted into a ranking.
+		RANK,
+		// Pairs of ranked placements tried against each other.
+		PAIR,
+		// The scan of the next piece between actions, counted with the action after it.
+		PONDER,
+		PHASE_COUNT
+	};
+
+	enum Counter {
+		CYCLES,
+		INSTRUCTIONS,
+		L1D_MISSES,
+		LLC_MISSES,
+		BRANCH_MISSES,
+		COUNTER_COUNT
+	};
+
+	struct Totals {
+		long long nanoseconds = 0;
+		long long counts[COUNTER_COUNT] = {};
+		long long calls = 0;
+	};
+
+	explicit PhaseProfiler(const string& path) : path_(path)
+	{
+		buffer_.reserve(kReservedBytes);
+
+		for (auto& fd : fds_)
+		{
+			fd = -1;
+		}
+
+		OpenCounters();
+
+		if (counterCount_ == 0)
+		{
+			cerr << "profile: hardware counters unavailable, timing phases only" << endl;
+		}
+	}
+
+	~PhaseProfiler()
+	{
+		EndGame();
+
+#ifdef __linux__
+		for (const auto fd : fds_)
+		{
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+		}
+#endif
+	}
+
+	PhaseProfiler(const PhaseProfiler&) = delete;
+	PhaseProfiler& operator=(const PhaseProfiler&) = delete;
+
+	bool HasCounters() const { return counterCount_ > 0; }
+
+	void StartAction(const int round)
+	{
+		round_ = round;
+	}
+
+	// Ends the phase running, if any, and starts the given one.
+	void Enter(const Phase phase)
+	{
+		Sample now;
+		Read(now);
+
+		if (phase_ != PHASE_COUNT)
+		{
+			Add(action_[phase_], started_, now);
+		}
+
+		phase_ = phase;
+		started_ = now;
+	}
+
+	void Leave()
+	{
+		if (phase_ == PHASE_COUNT)
+		{
+			return;
+		}
+
+		Sample now;
+		Read(now);
+		Add(action_[phase_], started_, now);
+		phase_ = PHASE_COUNT;
+	}
+
+	// Appends the phases of the action to the report and to the game totals.
+	void EndAction()
+	{
+		Leave();
+
+		char line[kMaxLine];
+		auto length = snprintf(line, sizeof(line), "{\"event\":\"action\",\"round\":%d,\"counters\":%s,\"phases\":{", round_,
+			HasCounters() ? "true" : "false");
+		length += FormatPhases(line + length, sizeof(line) - length, action_);
+		length += snprintf(line + length, sizeof(line) - length, "}}\n");
+		buffer_.append(line, static_cast<size_t>(length));
+
+		for (auto phase = 0; phase < PHASE_COUNT; phase++)
+		{
+			game_[phase].nanoseconds += action_[phase].nanoseconds;
+			game_[phase].calls += action_[phase].calls;
+			for (auto counter = 0; counter < COUNTER_COUNT; counter++)
+			{
+				game_[phase].counts[counter] += action_[phase].counts[counter];
+			}
+			action_[phase] = Totals();
+		}
+		actions_++;
+	}
+
+	// Appends the game totals and writes the report, a profiler without actions writes nothing.
+	void EndGame()
+	{
+		Leave();
+
+		if (actions_ == 0)
+		{
+			return;
+		}
+
+		char line[kMaxLine];
+		auto length = snprintf(line, sizeof(line), "{\"event\":\"game\",\"actions\":%d,\"counters\":%s,\"phases\":{", actions_,
+			HasCounters() ? "true" : "false");
+		length += FormatPhases(line + length, sizeof(line) - length, game_);
+		length += snprintf(line + length, sizeof(line) - length, "}}\n");
+		buffer_.append(line, static_cast<size_t>(length));
+
+		for (auto& totals : game_)
+		{
+			totals = Totals();
+		}
+		actions_ = 0;
+
+		//"-" reports to stderr next to the other statistics
+		if (path_ == "-")
+		{
+			cerr << buffer_;
+		}
+		else
+		{
+			ofstream out(path_, ios::app);
+			out << buffer_;
+			if (!out)
+			{
+				cerr << "Unable to write profile " << path_ << endl;
+			}
+		}
+		buffer_.clear();
+	}
+
+private:
+	// Room for a few thousand actions before the buffer has to grow.
+	static const size_t kReservedBytes = 1024 * 1024;
+	static const size_t kMaxLine = 2048;
+
+	struct Sample {
+		chrono::steady_clock::time_point time;
+		long long counts[COUNTER_COUNT];
+	};
+
+	static const char* PhaseName(const int phase)
+	{
+		static const char* const names[PHASE_COUNT] = { "scan", "rank", "pair", "ponder" };
+		return names[phase];
+	}
+
+	static const char* CounterName(const int counter)
+	{
+		static const char* const names[COUNTER_COUNT] = { "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses" };
+		return names[counter];
+	}
+
+	//Phases that ran, counters the kernel gave us, a counter it refused is left out rather than reported as zero
+	int FormatPhases(char* out, const size_t size, const Totals* totals) const
+	{
+		auto length = 0;
+		auto first = true;
+
+		for (auto phase = 0; phase < PHASE_COUNT; phase++)
+		{
+			if (totals[phase].calls == 0)
+			{
+				continue;
+			}
+
+			length += snprintf(out + length, size - length, "%s\"%s\":{\"calls\":%lld,\"ns\":%lld", first ? "" : ",", PhaseName(phase),
+				totals[phase].calls, totals[phase].nanoseconds);
+			for (auto counter = 0; counter < COUNTER_COUNT; counter++)
+			{
+				if (fds_[counter] >= 0)
+				{
+					length += snprintf(out + length, size - length, ",\"%s\":%lld", CounterName(counter), totals[phase].counts[counter]);
+				}
+			}
+			length += snprintf(out + length, size - length, "}");
+			first = false;
+		}
+
+		return length;
+	}
+
+	static void Add(Totals& totals, const Sample& from, const Sample& to)
+	{
+		totals.nanoseconds += chrono::duration_cast<chrono::nanoseconds>(to.time - from.time).count();
+		totals.calls++;
+		for (auto counter = 0; counter < COUNTER_COUNT; counter++)
+		{
+			totals.counts[counter] += to.counts[counter] - from.counts[counter];
+		}
+	}
+
+#ifdef __linux__
+	//Opens the counters as one group so a single read returns all of them, the first one that opens leads
+	void OpenCounters()
+	{
+		static const uint32_t types[COUNTER_COUNT] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+			PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE };
+		static const uint64_t configs[COUNTER_COUNT] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+			PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+
+		auto leader = -1;
+		for (auto counter = 0; counter < COUNTER_COUNT; counter++)
+		{
+			perf_event_attr attributes;
+			memset(&attributes, 0, sizeof(attributes));
+			attributes.size = sizeof(attributes);
+			attributes.type = types[counter];
+			attributes.config = configs[counter];
+			attributes.disabled = leader < 0 ? 1 : 0;
+			attributes.exclude_kernel = 1;
+			attributes.exclude_hv = 1;
+			attributes.read_format = PERF_FORMAT_GROUP;
+
+			//This thread on any CPU
+			const auto fd = static_cast<int>(syscall(__NR_perf_event_open, &attributes, 0, -1, leader, 0));
+			if (fd < 0)
+			{
+				continue;
+			}
+
+			if (leader < 0)
+			{
+				leader = fd;
+			}
+			fds_[counter] = fd;
+			slots_[counter] = counterCount_++;
+		}
+
+		if (leader >= 0 && ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) != 0)
+		{
+			for (auto& fd : fds_)
+			{
+				if (fd >= 0)
+				{
+					close(fd);
+					fd = -1;
+				}
+			}
+			counterCount_ = 0;
+		}
+		leader_ = leader;
+	}
+
+	void Read(Sample& sample) const
+	{
+		sample.time = chrono::steady_clock::now();
+		memset(sample.counts, 0, sizeof(sample.counts));
+
+		if (counterCount_ == 0)
+		{
+			return;
+		}
+
+		//Number of counters, then their values in the order they were opened
+		uint64_t values[1 + COUNTER_COUNT];
+		if (read(leader_, values, sizeof(values)) < static_cast<ssize_t>((1 + counterCount_) * sizeof(uint64_t)))
+		{
+			return;
+		}
+
+		for (auto counter = 0; counter < COUNTER_COUNT; counter++)
+		{
+			if (fds_[counter] >= 0)
+			{
+				sample.counts[counter] = static_cast<long long>(values[1 + slots_[counter]]);
+			}
+		}
+	}
+#else
+	void OpenCounters()
+	{
+	}
+
+	void Read(Sample& sample) const
+	{
+		sample.time = chrono::steady_clock::now();
+		memset(sample.counts, 0, sizeof(sample.counts));
+	}
+#endif
+
+	string path_;
+	string buffer_;
+	int fds_[COUNTER_COUNT];
+	int slots_[COUNTER_COUNT] = {};
+	int counterCount_ = 0;
+	int leader_ = -1;
+	int round_ = 0;
+	int actions_ = 0;
+	Phase phase_ = PHASE_COUNT;
+	Sample started_ = {};
+	Totals action_[PHASE_COUNT];
+	Totals game_[PHASE_COUNT];
+};
+
+#endif  // __PHASE_PROFILER_H
@@ -0,0 +1,142 @@
+#ifndef __PIECE_TABLE_H
+#define __PIECE_TABLE_H
+
+#include <climits>
+#include <cstdint>
+
+using namespace std;
+
+/**
+ * Cell offsets of every piece orientation, relative to the anchor used by
+ * Field::CheckValidShapePosition: (x, y) is the leftmost column of the
+ * piece and its bottom row, all other cells have dx >= 0 and dy <= 0.
+ * Shapes use the Shape::ShapeType numbering, I J L O S T Z.
+ */
+class PieceTable {
+public:
+	struct Offset {
+		int dx;
+		int dy;
+	};
+
+	struct Orientation {
+		Offset cells[4];
+		// Columns covered, starting at the anchor.
+		int width;
+		// Rows covered above the anchor row, the topmost cell has dy = 1 - height.
+		int height;
+		// Lowest dy in each covered column, this is what rests on the skyline.
+		int bottom[4];
+		// The cells as four 16-bit row masks at column 0, the anchor row in the lowest bits, see PairCollisions.
+		uint64_t rows;
+	};
+
+	static const int kShapeCount = 7;
+	static const int kMaxRotations = 4;
+	// Bits of a row in Orientation::rows, as wide as the widest field.
+	static const int kRowBits = 16;
+
+	static int RotationCount(const int shape)
+	{
+		static const int rotationCounts[kShapeCount] = { 2, 4, 4, 1, 2, 4, 2 };
+		return shape >= 0 && shape < kShapeCount ? rotationCounts[shape] : 0;
+	}
+
+	// Side of the square box the engine rotates the shape in, it spawns at column (width - size) / 2.
+	static int BoxSize(const int shape)
+	{
+		static const int sizes[kShapeCount] = { 4, 3, 3, 2, 3, 3, 3 };
+		return sizes[shape];
+	}
+
+	static const Orientation& Get(const int shape, const int rotation)
+	{
+		return Table().orientations[shape][rotation];
+	}
+
+private:
+	struct Orientations {
+		Orientation orientations[kShapeCount][kMaxRotations];
+	};
+
+	static const Orientations& Table()
+	{
+		static const Orientations table = Build();
+		return table;
+	}
+
+	static Orientations Build()
+	{
+		static const Offset offsets[kShapeCount][kMaxRotations][4] = {
+			// I
+			{ { { 0, 0 }, { 1, 0 }, { 2, 0 }, { 3, 0 } },
+			  { { 0, 0 }, { 0, -1 }, { 0, -2 }, { 0, -3 } } },
+			// J
+			{ { { 0, 0 }, { 1, 0 }, { 2, 0 }, { 0, -1 } },
+			  { { 0, 0 }, { 0, -1 }, { 0, -2 }, { 1, -2 } },
+			  { { 0, -1 }, { 1, -1 }, { 2, -1 }, { 2, 0 } },
+			  { { 1, 0 }, { 1, -1 }, { 1, -2 }, { 0, 0 } } },
+			// L
+			{ { { 0, 0 }, { 1, 0 }, { 2, 0 }, { 2, -1 } },
+			  { { 0, 0 }, { 0, -1 }, { 0, -2 }, { 1, 0 } },
+			  { { 0, -1 }, { 1, -1 }, { 2, -1 }, { 0, 0 } },
+			  { { 1, 0 }, { 1, -1 }, { 1, -2 }, { 0, -2 } } },
+			// O
+			{ { { 0, 0 }, { 1, 0 }, { 0, -1 }, { 1, -1 } } },
+			// S
+			{ { { 0, 0 }, { 1, 0 }, { 1, -1 }, { 2, -1 } },
+			  { { 1, 0 }, { 1, -1 }, { 0, -1 }, { 0, -2 } } },
+			// T
+			{ { { 0, 0 }, { 1, 0 }, { 2, 0 }, { 1, -1 } },
+			  { { 0, 0 }, { 0, -1 }, { 0, -2 }, { 1, -1 } },
+			  { { 1, 0 }, { 0, -1 }, { 1, -1 }, { 2, -1 } },
+			  { { 0, -1 }, { 1, 0 }, { 1, -1 }, { 1, -2 } } },
+			// Z
+			{ { { 1, 0 }, { 2, 0 }, { 0, -1 }, { 1, -1 } },
+			  { { 0, 0 }, { 0, -1 }, { 1, -1 }, { 1, -2 } } },
+		};
+
+		Orientations table = {};
+
+		for (auto shape = 0; shape < kShapeCount; shape++)
+		{
+			for (auto rotation = 0; rotation < RotationCount(shape); rotation++)
+			{
+				Orientation& orientation = table.orientations[shape][rotation];
+				orientation.width = 0;
+				orientation.height = 0;
+				orientation.rows = 0;
+
+				for (auto& bottom : orientation.bottom)
+				{
+					bottom = INT_MIN;
+				}
+
+				for (auto i = 0; i < 4; i++)
+				{
+					const Offset& offset = offsets[shape][rotation][i];
+					orientation.cells[i] = offset;
+
+					if (offset.dx + 1 > orientation.width)
+					{
+						orientation.width = offset.dx + 1;
+					}
+					if (1 - offset.dy > orientation.height)
+					{
+						orientation.height = 1 - offset.dy;
+					}
+					if (offset.dy > orientation.bottom[offset.dx])
+					{
+						orientation.bottom[offset.dx] = offset.dy;
+					}
+
+					orientation.rows |= uint64_t(1) << (-offset.dy * kRowBits + offset.dx);
+				}
+			}
+		}
+
+		return table;
+	}
+};
+
+#endif  // __PIECE_TABLE_H
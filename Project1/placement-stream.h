@@ -0,0 +1,230 @@
+#ifndef __PLACEMENT_STREAM_H
+#define __PLACEMENT_STREAM_H
+
+#include <algorithm>
+#include <limits>
+
+#include "bit-board.h"
+#include "field.h"
+
+using namespace std;
+
+struct ScoredPlacement {
+	float score;
+	Placement placement;
+};
+
+/**
+ * The placements of one piece, handed out best first as the search pulls
+ * them. Opening a stream on a field only computes Field::ScoreBound for
+ * every placement, a placement is scored once its bound says it might be
+ * the next one out. A search that stops pulling when the bound of the
+ * next rank cannot beat what it has never scores the rest. Equal scores
+ * come out in reverse scan order like in BotStarter's rankings, so a
+ * stream and a ranking of the same scores hand out the same sequence.
+ * The field must not change while the stream is pulled from.
+ */
+class PlacementStream {
+public:
+	// Covers the difference between a bound and the rounded score it bounds.
+	static constexpr double kBoundMargin = 1e-3;
+
+	// Bounds every placement of the shape, scoring waits for Get.
+	void Open(Field& field, const int shape)
+	{
+		Clear();
+		field_ = &field;
+		shape_ = shape;
+
+		Field::ScoreBase base;
+		field.PrepareScoreBound(base);
+
+		count_ = field.Board().Placements(shape, placements_);
+		for (auto i = 0; i < count_; i++)
+		{
+			bounds_[i] = field.ScoreBound(base, shape, placements_[i].rotation, placements_[i].x, placements_[i].y);
+			order_[i] = i;
+
+			//Scoring over the falling piece changes the grid for the placements after it, score them all in scan order
+			if (bounds_[i] == numeric_limits<double>::infinity())
+			{
+				for (auto j = 0; j < count_; j++)
+				{
+					Score(j);
+				}
+				nextUnscored_ = count_;
+				scoredCount_ = 0;
+				return;
+			}
+		}
+
+		sort(order_, order_ + count_, [this](const int a, const int b) { return bounds_[a] > bounds_[b]; });
+		bounded_ = count_;
+	}
+
+	// Placements scored elsewhere, in scan order.
+	void Assign(const ScoredPlacement* scored, const int count)
+	{
+		Clear();
+
+		count_ = count;
+		for (auto i = 0; i < count; i++)
+		{
+			placements_[i] = scored[i].placement;
+			scores_[i] = scored[i].score;
+			isScored_[i] = true;
+			pending_[pendingCount_++] = i;
+		}
+		nextUnscored_ = count;
+	}
+
+	// Placement at the given rank, scoring as many as it takes to know which one it is. False past the last one.
+	bool Get(const int rank, ScoredPlacement& result)
+	{
+		while (yieldedCount_ <= rank)
+		{
+			if (!Advance())
+			{
+				return false;
+			}
+		}
+
+		const auto index = yielded_[rank];
+		result.score = scores_[index];
+		result.placement = placements_[index];
+		return true;
+	}
+
+	// Position in scan order of the placement at the given rank, once Get handed it out.
+	int ScanIndex(const int rank) const { return yielded_[rank]; }
+
+	// Every placement in scan order, scored or not.
+	const Placement* Placements() const { return placements_; }
+
+	// Upper bound of the score at the given rank without scoring anything, exact once the rank was handed out.
+	double Bound(const int rank) const
+	{
+		if (rank < yieldedCount_)
+		{
+			return scores_[yielded_[rank]];
+		}
+
+		auto bound = -numeric_limits<double>::infinity();
+		const auto best = BestPending();
+		if (best >= 0)
+		{
+			bound = scores_[pending_[best]];
+		}
+		if (nextUnscored_ < count_)
+		{
+			bound = max(bound, bounds_[order_[nextUnscored_]] + kBoundMargin);
+		}
+		return bound;
+	}
+
+	int Count() const { return count_; }
+
+	// Placements the stream bounded instead of scoring, 0 when they were assigned.
+	int BoundedCount() const { return bounded_; }
+
+	int ScoredCount() const { return scoredCount_; }
+
+	// Writes the placements scored so far in scan order and returns how many.
+	int ScoredInScanOrder(ScoredPlacement* scored) const
+	{
+		auto written = 0;
+		for (auto i = 0; i < count_; i++)
+		{
+			if (isScored_[i])
+			{
+				scored[written].score = scores_[i];
+				scored[written].placement = placements_[i];
+				written++;
+			}
+		}
+		return written;
+	}
+
+private:
+	void Clear()
+	{
+		field_ = nullptr;
+		count_ = 0;
+		bounded_ = 0;
+		scoredCount_ = 0;
+		nextUnscored_ = 0;
+		pendingCount_ = 0;
+		yieldedCount_ = 0;
+		fill(isScored_, isScored_ + BitBoard::kMaxPlacements, false);
+	}
+
+	void Score(const int index)
+	{
+		const Placement& placement = placements_[index];
+		scores_[index] = static_cast<float>(field_->ScorePlacement(shape_, placement.rotation, placement.x, placement.y));
+		isScored_[index] = true;
+		pending_[pendingCount_++] = index;
+		scoredCount_++;
+	}
+
+	//Slot in pending_ of the best scored placement not handed out yet, the later one in scan order on equal scores
+	int BestPending() const
+	{
+		auto best = -1;
+		for (auto slot = 0; slot < pendingCount_; slot++)
+		{
+			const auto index = pending_[slot];
+			if (best < 0 || scores_[index] > scores_[pending_[best]] || (scores_[index] == scores_[pending_[best]] && index > pending_[best]))
+			{
+				best = slot;
+			}
+		}
+		return best;
+	}
+
+	//Hands out the next rank once no unscored bound could reach it
+	bool Advance()
+	{
+		while (true)
+		{
+			const auto best = BestPending();
+
+			if (nextUnscored_ < count_ && (best < 0 || bounds_[order_[nextUnscored_]] + kBoundMargin >= scores_[pending_[best]]))
+			{
+				Score(order_[nextUnscored_++]);
+				continue;
+			}
+
+			if (best < 0)
+			{
+				return false;
+			}
+
+			yielded_[yieldedCount_++] = pending_[best];
+			pending_[best] = pending_[--pendingCount_];
+			return true;
+		}
+	}
+
+	Field* field_ = nullptr;
+	int shape_ = 0;
+	int count_ = 0;
+	int bounded_ = 0;
+	int scoredCount_ = 0;
+	// Position in order_ of the best bounded placement not scored yet.
+	int nextUnscored_ = 0;
+	int pendingCount_ = 0;
+	int yieldedCount_ = 0;
+	Placement placements_[BitBoard::kMaxPlacements];
+	double bounds_[BitBoard::kMaxPlacements];
+	// Placements by bound, best first.
+	int order_[BitBoard::kMaxPlacements];
+	float scores_[BitBoard::kMaxPlacements];
+	bool isScored_[BitBoard::kMaxPlacements];
+	// Scored but not handed out yet.
+	int pending_[BitBoard::kMaxPlacements];
+	// Handed out, by rank.
+	int yielded_[BitBoard::kMaxPlacements];
+};
+
+#endif  // __PLACEMENT_STREAM_H
@@ -21,6 +21,8 @@ class Player {
 
   Field& field() const { return *field_; }
 
+  bool has_field() const { return field_ != nullptr; }
+
   void set_field(unique_ptr<Field> field) { field_ = std::move(field); }
 
   const string& name() const { return name_; }
@@ -0,0 +1,506 @@
+#ifndef __REFEREE_H
+#define __REFEREE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bit-board.h"
+#include "bot-config.h"
+#include "move.h"
+#include "perft.h"
+#include "piece-table.h"
+
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/**
+ * Plays matches between two bot commands the way the competition engine
+ * does, each bot a process talking the text protocol over its stdin and
+ * stdout. Both players get the same pieces, score row points for cleared
+ * lines and combos, send a garbage row to the other one for every
+ * kPointsPerGarbageRow points, and get a solid row every
+ * BitBoard::kRoundsPerSolidRow rounds. Each action is timed from the
+ * action line written to the reply read, against a timebank that gains
+ * the time per move after every action. A bot that runs out of it, tops
+ * out, answers nonsense or exits loses. T-spins and perfect clears are
+ * not scored. Matches run in parallel and the report gives the score of
+ * the first command with its confidence interval and the latency
+ * percentiles of both.
+ */
+class Referee {
+public:
+	explicit Referee(const BotConfig& config) : config_(config) {
+		commands_[0] = config.refereeCommand;
+		commands_[1] = config.refereeOpponent.empty() ? config.refereeCommand : config.refereeOpponent;
+	}
+
+	int Run() {
+#ifdef _WIN32
+		cerr << "Referee mode needs POSIX pipes and processes and is not available on this platform" << endl;
+		return 1;
+#else
+		// A bot that exits while we write to it is a lost game, not a reason to die.
+		signal(SIGPIPE, SIG_IGN);
+
+		const auto hardware = max(1u, thread::hardware_concurrency());
+		const auto threads = config_.refereeThreads > 0 ? config_.refereeThreads : max(1u, hardware / 2);
+		cerr << "referee: " << config_.refereeMatches << " matches of \"" << commands_[0] << "\" against \"" << commands_[1]
+			<< "\" on " << threads << " threads" << endl;
+
+		vector<thread> workers;
+		for (unsigned int i = 0; i < threads; i++) {
+			workers.emplace_back([this] {
+				for (int match = nextMatch_++; match < config_.refereeMatches; match = nextMatch_++) {
+					PlayMatch(match);
+				}
+			});
+		}
+		for (auto& worker : workers) {
+			worker.join();
+		}
+
+		Report();
+		return failures_ > 0 || badExits_[0] > 0 || badExits_[1] > 0 ? 1 : 0;
+#endif
+	}
+
+private:
+	typedef chrono::steady_clock Clock;
+
+	static const int kWidth = 10;
+	static const int kHeight = 20;
+	static const int kTimebankMs = 10000;
+	static const int kTimePerMoveMs = 500;
+	static const int kPointsPerGarbageRow = 4;
+	// Matches still running by then are decided on points.
+	static const int kMaxRounds = 2000;
+	// Time a bot gets to exit once its stdin is closed, checked every kExitPollMs.
+	static const int kExitGraceMs = 1500;
+	static const int kExitPollMs = 5;
+
+	// Bot process of one side of a match.
+	struct Seat {
+		int pid = -1;
+		int in = -1;
+		int out = -1;
+		string pending;
+		BitBoard board;
+		int points = 0;
+		int combo = 0;
+		int garbageSent = 0;
+		int timebankMs = kTimebankMs;
+		Clock::time_point actionStart;
+		bool replied = false;
+		bool lost = false;
+		vector<uint64_t> latencies;
+	};
+
+	static const char* PlayerName(const int player) {
+		static const char* const names[2] = { "player1", "player2" };
+		return names[player];
+	}
+
+	static char ShapeName(const int shape) {
+		static const char names[PieceTable::kShapeCount + 1] = "IJLOSTZ";
+		return names[shape];
+	}
+
+#ifndef _WIN32
+	// Starts the command through the shell with its stdin and stdout on pipes, stderr is dropped.
+	static bool Launch(const string& command, Seat& seat) {
+		int toBot[2];
+		int fromBot[2];
+		if (pipe2(toBot, O_CLOEXEC) != 0) {
+			return false;
+		}
+		if (pipe2(fromBot, O_CLOEXEC) != 0) {
+			close(toBot[0]);
+			close(toBot[1]);
+			return false;
+		}
+
+		// The shell replaces itself with the bot, so the pid is the one to kill
+		const auto shellCommand = "exec " + command;
+		const auto pid = fork();
+		if (pid == 0) {
+			// Only calls that are safe between fork and exec in a threaded process
+			dup2(toBot[0], STDIN_FILENO);
+			dup2(fromBot[1], STDOUT_FILENO);
+			const int devNull = open("/dev/null", O_WRONLY);
+			if (devNull >= 0) {
+				dup2(devNull, STDERR_FILENO);
+			}
+			execl("/bin/sh", "sh", "-c", shellCommand.c_str(), static_cast<char*>(nullptr));
+			_exit(127);
+		}
+
+		close(toBot[0]);
+		close(fromBot[1]);
+		if (pid < 0) {
+			close(toBot[1]);
+			close(fromBot[0]);
+			return false;
+		}
+
+		seat.pid = pid;
+		seat.in = toBot[1];
+		seat.out = fromBot[0];
+		return true;
+	}
+
+	// Closing stdin ends the bot's game loop and its end of game code runs, a bot still there after
+	// kExitGraceMs is killed. Returns the wait status, -1 when it had to be killed.
+	static int Stop(Seat& seat) {
+		if (seat.in >= 0) {
+			close(seat.in);
+			seat.in = -1;
+		}
+
+		auto status = 0;
+		auto killed = false;
+		if (seat.pid > 0) {
+			const auto deadline = Clock::now() + chrono::milliseconds(kExitGraceMs);
+			auto exited = waitpid(seat.pid, &status, WNOHANG);
+			while ((exited == 0 || (exited < 0 && errno == EINTR)) && Clock::now() < deadline) {
+				this_thread::sleep_for(chrono::milliseconds(kExitPollMs));
+				exited = waitpid(seat.pid, &status, WNOHANG);
+			}
+
+			if (exited == 0 || (exited < 0 && errno == EINTR)) {
+				kill(seat.pid, SIGKILL);
+				waitpid(seat.pid, nullptr, 0);
+				killed = true;
+			}
+			seat.pid = -1;
+		}
+
+		// Open until the bot is gone, whatever it writes at the end of the game must not hit a closed pipe
+		if (seat.out >= 0) {
+			close(seat.out);
+			seat.out = -1;
+		}
+		return killed ? -1 : status;
+	}
+
+	// How the bot ended for the report, empty for a clean exit.
+	static string ExitDescription(const int status) {
+		char text[64] = "";
+		if (status < 0) {
+			snprintf(text, sizeof(text), "killed after %d ms without exiting", kExitGraceMs);
+		}
+		else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+			snprintf(text, sizeof(text), "exit code %d", WEXITSTATUS(status));
+		}
+		else if (WIFSIGNALED(status)) {
+			snprintf(text, sizeof(text), "signal %d", WTERMSIG(status));
+		}
+		return text;
+	}
+
+	static bool Send(Seat& seat, const string& text) {
+		for (size_t written = 0; written < text.size();) {
+			const auto count = write(seat.in, text.data() + written, text.size() - written);
+			if (count < 0 && errno == EINTR) {
+				continue;
+			}
+			if (count <= 0) {
+				return false;
+			}
+			written += static_cast<size_t>(count);
+		}
+		return true;
+	}
+
+	// Reads whatever the bot wrote, false once it closed its stdout.
+	static bool Receive(Seat& seat) {
+		char buffer[512];
+		ssize_t count;
+		do {
+			count = read(seat.out, buffer, sizeof(buffer));
+		} while (count < 0 && errno == EINTR);
+
+		if (count <= 0) {
+			return false;
+		}
+		seat.pending.append(buffer, static_cast<size_t>(count));
+		return true;
+	}
+
+	// Waits for both replies, each until its timebank runs out, the seats without one lose.
+	static void AwaitReplies(Seat* seats) {
+		while (true) {
+			pollfd fds[2];
+			nfds_t count = 0;
+			int seatOf[2];
+			auto waitMs = kTimebankMs;
+			const auto now = Clock::now();
+
+			for (auto player = 0; player < 2; player++) {
+				auto& seat = seats[player];
+				if (seat.replied || seat.lost) {
+					continue;
+				}
+
+				const auto elapsedMs = chrono::duration_cast<chrono::milliseconds>(now - seat.actionStart).count();
+				if (elapsedMs > seat.timebankMs) {
+					seat.lost = true;
+					continue;
+				}
+
+				waitMs = min(waitMs, static_cast<int>(seat.timebankMs - elapsedMs) + 1);
+				fds[count].fd = seat.out;
+				fds[count].events = POLLIN;
+				fds[count].revents = 0;
+				seatOf[count++] = player;
+			}
+
+			if (count == 0) {
+				return;
+			}
+
+			if (poll(fds, count, waitMs) < 0 && errno != EINTR) {
+				return;
+			}
+
+			for (nfds_t i = 0; i < count; i++) {
+				if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0) {
+					continue;
+				}
+
+				auto& seat = seats[seatOf[i]];
+				if (!Receive(seat)) {
+					seat.lost = true;
+				}
+				else if (seat.pending.find('\n') != string::npos) {
+					const auto latency = chrono::duration_cast<chrono::microseconds>(Clock::now() - seat.actionStart).count();
+					seat.latencies.push_back(static_cast<uint64_t>(latency));
+					const auto timebankMs = seat.timebankMs - static_cast<int>(latency / 1000) + kTimePerMoveMs;
+					seat.timebankMs = timebankMs < kTimebankMs ? timebankMs : kTimebankMs;
+					seat.replied = true;
+				}
+			}
+		}
+	}
+#endif
+
+	// Settings first, then every round the updates of both players and the action.
+	static string Round(const Perft& perft, const Seat* seats, const int player, const int round, const int current, const int next) {
+		string text;
+		char line[512];
+
+		if (round == 1) {
+			snprintf(line, sizeof(line), "settings timebank %d\nsettings time_per_move %d\nsettings player_names player1,player2\n"
+				"settings your_bot %s\nsettings field_width %d\nsettings field_height %d\n", kTimebankMs, kTimePerMoveMs,
+				PlayerName(player), kWidth, kHeight);
+			text += line;
+		}
+
+		snprintf(line, sizeof(line), "update game round %d\nupdate game this_piece_type %c\nupdate game next_piece_type %c\n"
+			"update game this_piece_position %d,-1\n", round, ShapeName(current), ShapeName(next),
+			(kWidth - PieceTable::BoxSize(current)) / 2);
+		text += line;
+
+		for (auto other = 0; other < 2; other++) {
+			snprintf(line, sizeof(line), "update %s row_points %d\nupdate %s combo %d\nupdate %s field ", PlayerName(other),
+				seats[other].points, PlayerName(other), seats[other].combo, PlayerName(other));
+			text += line;
+			perft.AppendField(seats[other].board, current, text);
+			text += '\n';
+		}
+
+		snprintf(line, sizeof(line), "action moves %d\n", seats[player].timebankMs);
+		text += line;
+		return text;
+	}
+
+	// Plays the reply on the seat's board and scores the lines it clears.
+	static void Apply(const Perft& perft, Seat& seat, const int shape) {
+		Move::MoveType moves[BitBoard::kMaxWidth * 4];
+		const auto end = seat.pending.find('\n');
+		const auto count = Move::ParseMoves(seat.pending, end, moves, BitBoard::kMaxWidth * 4);
+		seat.pending.erase(0, end + 1);
+
+		Placement placement;
+		if (count < 0 || !perft.Play(seat.board, shape, moves, count, placement)) {
+			seat.lost = true;
+			return;
+		}
+
+		seat.board.Place(shape, placement.rotation, placement.x, placement.y);
+		const auto lines = seat.board.ClearLines();
+
+		static const int linePoints[5] = { 0, 0, 3, 6, 10 };
+		if (lines > 0) {
+			seat.points += linePoints[lines] + seat.combo;
+			seat.combo++;
+		}
+		else {
+			seat.combo = 0;
+		}
+	}
+
+	void PlayMatch(const int match) {
+#ifndef _WIN32
+		// Odd matches swap the seats, the same pieces go to both players anyway.
+		const auto first = match % 2;
+		Seat seats[2];
+		for (auto player = 0; player < 2; player++) {
+			seats[player].board = BitBoard(kWidth, kHeight);
+			if (!Launch(commands_[player ^ first], seats[player])) {
+				cerr << "referee: unable to start " << commands_[player ^ first] << endl;
+				failures_++;
+				Stop(seats[0]);
+				return;
+			}
+		}
+
+		mt19937 random(static_cast<uint32_t>(match + 1));
+		auto current = static_cast<int>(random() % PieceTable::kShapeCount);
+		auto next = static_cast<int>(random() % PieceTable::kShapeCount);
+		Perft perft;
+
+		auto round = 1;
+		for (; round <= kMaxRounds && !seats[0].lost && !seats[1].lost; round++) {
+			for (auto player = 0; player < 2; player++) {
+				auto& seat = seats[player];
+				const auto text = Round(perft, seats, player, round, current, next);
+				seat.replied = false;
+				seat.actionStart = Clock::now();
+				seat.lost = !Send(seat, text);
+			}
+
+			AwaitReplies(seats);
+
+			for (auto& seat : seats) {
+				seat.lost = seat.lost || !seat.replied;
+				if (!seat.lost) {
+					Apply(perft, seat, current);
+				}
+			}
+
+			// Garbage goes out after both pieces landed
+			for (auto player = 0; player < 2; player++) {
+				auto& opponent = seats[1 - player];
+				for (; seats[player].garbageSent < seats[player].points / kPointsPerGarbageRow; seats[player].garbageSent++) {
+					opponent.lost = !opponent.board.PushRow(static_cast<int>(random() % kWidth)) || opponent.lost;
+				}
+			}
+
+			if (round % BitBoard::kRoundsPerSolidRow == 0) {
+				for (auto& seat : seats) {
+					seat.lost = !seat.board.PushRow(-1) || seat.lost;
+				}
+			}
+
+			current = next;
+			next = static_cast<int>(random() % PieceTable::kShapeCount);
+		}
+
+		// Both out in the same round or both alive at the limit, the points decide
+		auto result = 0;
+		if (seats[0].lost != seats[1].lost) {
+			result = seats[0].lost ? -1 : 1;
+		}
+		else if (seats[0].points != seats[1].points) {
+			result = seats[0].points < seats[1].points ? -1 : 1;
+		}
+
+		int statuses[2];
+		for (auto player = 0; player < 2; player++) {
+			statuses[player] = Stop(seats[player]);
+		}
+
+		lock_guard<mutex> lock(mutex_);
+		for (auto player = 0; player < 2; player++) {
+			const auto exit = ExitDescription(statuses[player]);
+			if (!exit.empty()) {
+				cerr << "referee: \"" << commands_[player ^ first] << "\" ended match " << match << " with " << exit << endl;
+				badExits_[player ^ first]++;
+			}
+		}
+
+		const auto firstResult = first == 0 ? result : -result;
+		wins_ += firstResult > 0 ? 1 : 0;
+		losses_ += firstResult < 0 ? 1 : 0;
+		draws_ += firstResult == 0 ? 1 : 0;
+		rounds_ += round - 1;
+		for (auto player = 0; player < 2; player++) {
+			auto& latencies = latencies_[player ^ first];
+			latencies.insert(latencies.end(), seats[player].latencies.begin(), seats[player].latencies.end());
+		}
+#endif
+	}
+
+	// Score of the first command, a win 1 and a draw 0.5, with a 95% normal interval over the matches.
+	void Report() {
+		const auto matches = wins_ + losses_ + draws_;
+		if (matches == 0) {
+			cerr << "referee: no match finished" << endl;
+			return;
+		}
+
+		const auto score = (wins_ + 0.5 * draws_) / matches;
+		const auto meanSquare = (wins_ + 0.25 * draws_) / matches;
+		const auto margin = 1.96 * sqrt(max(0.0, meanSquare - score * score) / matches);
+
+		char line[512];
+		snprintf(line, sizeof(line), "referee: %d matches, %.1f rounds on average, first command %d wins %d losses %d draws, score %.3f +- %.3f",
+			matches, static_cast<double>(rounds_) / matches, wins_, losses_, draws_, score, margin);
+		cerr << line << endl;
+
+		for (auto side = 0; side < 2; side++) {
+			auto& latencies = latencies_[side];
+			if (latencies.empty()) {
+				continue;
+			}
+
+			sort(latencies.begin(), latencies.end());
+			const auto percentile = [&latencies](const double fraction) {
+				return latencies[min(latencies.size() - 1, static_cast<size_t>(fraction * latencies.size()))] / 1000.0;
+			};
+
+			snprintf(line, sizeof(line), "referee: \"%s\" %zu actions, latency p50 %.2f ms p90 %.2f ms p99 %.2f ms max %.2f ms",
+				commands_[side].c_str(), latencies.size(), percentile(0.50), percentile(0.90), percentile(0.99), latencies.back() / 1000.0);
+			cerr << line << endl;
+		}
+
+		for (auto side = 0; side < 2; side++) {
+			if (badExits_[side] > 0) {
+				cerr << "referee: \"" << commands_[side] << "\" did not exit cleanly after " << badExits_[side] << " matches" << endl;
+			}
+		}
+	}
+
+	BotConfig config_;
+	string commands_[2];
+	atomic<int> nextMatch_{ 0 };
+	atomic<int> failures_{ 0 };
+	mutex mutex_;
+	int wins_ = 0;
+	int losses_ = 0;
+	int draws_ = 0;
+	long long rounds_ = 0;
+	// Matches after which a command exited with an error, a signal or had to be killed.
+	int badExits_[2] = { 0, 0 };
+	vector<uint64_t> latencies_[2];
+};
+
+#endif  // __REFEREE_H
@@ -0,0 +1,69 @@
+#ifndef __SEARCH_EXTENSION_H
+#define __SEARCH_EXTENSION_H
+
+#include <algorithm>
+
+#include "bit-board.h"
+
+using namespace std;
+
+/**
+ * Tells the boards where a deeper search changes the outcome from the ones
+ * where the pair search picks as well. A board is critical when its stack
+ * is close to the top, when two or more rows are a piece away from
+ * clearing together, when a well is deep enough to need an I piece, or
+ * when a solid row is about to come in. Quiet boards, most of a game, keep
+ * the fast search and the time goes to the critical ones.
+ */
+class SearchExtension {
+public:
+	// Rows left above the stack when it counts as high.
+	static const int kHeadroom = 6;
+	// Empty cells of a row that one placement can still fill.
+	static const int kNearFullCells = 2;
+	static const int kWellDepth = 3;
+	// Rounds before a solid row during which the board counts as critical.
+	static const int kSolidRowWarning = 2;
+
+	// Critical signs on the board in the given round, 0 for a quiet board.
+	static int Signs(const BitBoard& board, const int round)
+	{
+		auto top = board.height();
+		for (auto x = 0; x < board.width(); x++)
+		{
+			top = min(top, board.ColumnTop(x));
+		}
+
+		auto signs = top < kHeadroom ? 1 : 0;
+
+		//Solid rows never clear, only the rows above them count
+		auto nearFull = 0;
+		for (auto y = top; y < board.height() - board.SolidRows(); y++)
+		{
+			const auto empty = board.width() - PopCount(board.Row(y));
+			nearFull += empty > 0 && empty <= kNearFullCells ? 1 : 0;
+		}
+		signs += nearFull >= 2 ? 1 : 0;
+
+		//The walls are as high as the field
+		for (auto x = 0; x < board.width(); x++)
+		{
+			const auto left = x > 0 ? board.ColumnHeight(x - 1) : board.height();
+			const auto right = x + 1 < board.width() ? board.ColumnHeight(x + 1) : board.height();
+
+			if (min(left, right) - board.ColumnHeight(x) >= kWellDepth)
+			{
+				signs++;
+				break;
+			}
+		}
+
+		const auto solidRowRounds = BitBoard::kRoundsPerSolidRow;
+		const auto roundsToSolidRow = (solidRowRounds - round % solidRowRounds) % solidRowRounds;
+		signs += roundsToSolidRow < kSolidRowWarning ? 1 : 0;
+
+		return signs;
+	}
+};
+
+#endif  // __SEARCH_EXTENSION_H
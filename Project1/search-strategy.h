@@ -0,0 +1,70 @@
+#ifndef __SEARCH_STRATEGY_H
+#define __SEARCH_STRATEGY_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+/**
+ * The searches BotStarter can decide with. All of them score placements
+ * with the same scan and evaluator and differ in how far they look ahead.
+ * The strategy is picked once per action and the search runs as a plain
+ * member call from there, nothing in the loops is dispatched. Chosen with
+ * --engine at startup or with the "strategy" setting of a game, so that
+ * one binary can play several of them side by side.
+ */
+class SearchStrategies {
+public:
+	enum Kind {
+		// Best placement of the current piece alone.
+		GREEDY,
+		// Best pair of the current and next piece on the same board, the default.
+		PAIR,
+		// The best current placements played out, the next piece scanned on each resulting board.
+		BEAM,
+		// Beam over both known pieces, then the best placement of every possible third piece averaged.
+		DEEP,
+		// Tree search of MctsEngine, the pair search when it finds nothing.
+		MCTS,
+		COUNT
+	};
+
+	// Work and time one strategy spent, nodes are placements scored and pairs tried, or playouts for MCTS.
+	struct Stats {
+		long long actions = 0;
+		long long nodes = 0;
+		long long nanoseconds = 0;
+		// Actions that carried on with the search tree of the one before.
+		long long reused = 0;
+	};
+
+	// Returns -1 and lists the strategies when the name is unknown.
+	static int Find(const string& name)
+	{
+		//"heuristic" was the name of the pair search before there were others
+		if (name == "heuristic")
+		{
+			return PAIR;
+		}
+
+		for (auto kind = 0; kind < COUNT; kind++)
+		{
+			if (name == Name(kind))
+			{
+				return kind;
+			}
+		}
+
+		cerr << "Unknown strategy " << name << ", available: greedy, pair, beam, deep, mcts" << endl;
+		return -1;
+	}
+
+	static const char* Name(const int kind)
+	{
+		static const char* const names[COUNT] = { "greedy", "pair", "beam", "deep", "mcts" };
+		return names[kind];
+	}
+};
+
+#endif  // __SEARCH_STRATEGY_H
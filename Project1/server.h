@@ -0,0 +1,199 @@
+#ifndef __SERVER_H
+#define __SERVER_H
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "batch-decider.h"
+#include "bot-config.h"
+#include "bot-parser.h"
+#include "bot-starter.h"
+#include "ensemble-evaluator.h"
+#include "fd-stream.h"
+#include "neural-evaluator.h"
+#include "pattern-cache.h"
+#include "worker-pool.h"
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/**
+ * Hosts many games in one process.
+ * Every connection on the Unix socket is one game speaking the normal
+ * engine protocol. Each session owns its BotState and BotStarter, while
+ * the searches of all sessions run on one shared WorkerPool and use one
+ * PatternCache, both counted against the memory budget. The MCTS node
+ * pool of a session is only counted, and only given, with --engine mcts.
+ */
+class SessionServer {
+public:
+	explicit SessionServer(const BotConfig& config)
+		: config_(config), pool_(config.workerThreads) {
+		size_t budgetMb = config.memoryBudgetMb;
+		if (!config.patternCachePath.empty() &&
+			patternCache_.Open(config.patternCachePath, config.patternCacheMb, PatternCache::Fingerprint(config))) {
+			budgetMb -= min(budgetMb, config.patternCacheMb);
+		}
+		if (!config.neuralWeightsPath.empty()) {
+			neuralEvaluator_.Load(config.neuralWeightsPath);
+		}
+		if (!config.ensemblePath.empty()) {
+			ensembleEvaluator_.Load(config.ensemblePath, config.ensembleCombine);
+		}
+
+		size_t footprint = kSessionFootprint;
+		if (config.engine == "mcts") {
+			footprint += config.mctsNodes * MctsEngine::NodeBytes();
+		}
+		else {
+			// Not budgeted, so a game sending "settings strategy mcts" gets the configured engine instead.
+			config_.mctsNodes = 0;
+		}
+		maxSessions_ = max<size_t>(1, budgetMb * 1024 * 1024 / footprint);
+	}
+
+	int Run() {
+#ifdef _WIN32
+		cerr << "Server mode needs Unix domain sockets and is not available on this platform" << endl;
+		return 1;
+#else
+		// A client that disconnects while we write to it ends its session, not the server.
+		signal(SIGPIPE, SIG_IGN);
+
+		const int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listenFd < 0) {
+			cerr << "Unable to create socket" << endl;
+			return 1;
+		}
+
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		if (config_.serverPath.size() >= sizeof(address.sun_path)) {
+			cerr << "Socket path too long: " << config_.serverPath << endl;
+			close(listenFd);
+			return 1;
+		}
+		config_.serverPath.copy(address.sun_path, config_.serverPath.size());
+		unlink(config_.serverPath.c_str());
+
+		if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+			listen(listenFd, 128) != 0) {
+			cerr << "Unable to listen on " << config_.serverPath << endl;
+			close(listenFd);
+			return 1;
+		}
+
+		cerr << "Serving games on " << config_.serverPath << " with " << pool_.size()
+			<< " workers, at most " << maxSessions_ << " sessions" << endl;
+		started_ = Clock::now();
+
+		int nextSession = 0;
+		while (true) {
+			const int sessionFd = accept(listenFd, nullptr, nullptr);
+			if (sessionFd < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				break;
+			}
+
+			// Stay within the memory budget by holding new games back.
+			{
+				unique_lock<mutex> lock(mutex_);
+				sessionEnded_.wait(lock, [this] { return activeSessions_ < maxSessions_; });
+				activeSessions_++;
+			}
+
+			const int session = nextSession++;
+			thread([this, sessionFd, session] { ServeSession(sessionFd, session); }).detach();
+		}
+
+		close(listenFd);
+		unique_lock<mutex> lock(mutex_);
+		sessionEnded_.wait(lock, [this] { return activeSessions_ == 0; });
+		return 0;
+#endif
+	}
+
+private:
+	typedef chrono::steady_clock Clock;
+
+	// Rough upper bound of what one game keeps alive: two fields, state and buffers.
+	static const size_t kSessionFootprint = 256 * 1024;
+
+#ifndef _WIN32
+	void ServeSession(int fd, int session) {
+		const auto gameStart = Clock::now();
+		{
+			FdStreamBuf buffer(fd);
+			istream in(&buffer);
+			ostream out(&buffer);
+
+			BotStarter bot(config_);
+			if (patternCache_.IsOpen()) {
+				bot.SetPatternCache(&patternCache_);
+			}
+			if (neuralEvaluator_.IsLoaded()) {
+				bot.SetNeuralEvaluator(&neuralEvaluator_);
+			}
+			if (ensembleEvaluator_.IsLoaded()) {
+				bot.SetEnsembleEvaluator(&ensembleEvaluator_);
+			}
+			BatchDecider batch(config_, pool_, session);
+			if (neuralEvaluator_.IsLoaded()) {
+				batch.SetNeuralEvaluator(&neuralEvaluator_);
+			}
+			if (ensembleEvaluator_.IsLoaded()) {
+				batch.SetEnsembleEvaluator(&ensembleEvaluator_);
+			}
+			BotParser parser(bot, pool_, session);
+			parser.SetBatchDecider(&batch);
+			parser.Run(in, out);
+		}
+		close(fd);
+
+		const WorkerPool::ClientStats stats = pool_.Stats(session);
+		pool_.Forget(session);
+
+		lock_guard<mutex> lock(mutex_);
+		gamesPlayed_++;
+		const double gameSeconds = chrono::duration<double>(Clock::now() - gameStart).count();
+		const double hours = chrono::duration<double>(Clock::now() - started_).count() / 3600.0;
+		const long long actions = max(1LL, stats.jobs);
+
+		cerr << "session " << session << ": " << stats.jobs << " actions in " << gameSeconds << "s"
+			<< ", wait avg " << stats.totalWaitMs / actions << "ms max " << stats.maxWaitMs << "ms"
+			<< ", search avg " << stats.totalRunMs / actions << "ms max " << stats.maxRunMs << "ms"
+			<< ", " << gamesPlayed_ / max(hours, 1e-9) << " games/hour" << endl;
+
+		activeSessions_--;
+		sessionEnded_.notify_all();
+	}
+#endif
+
+	BotConfig config_;
+	WorkerPool pool_;
+	PatternCache patternCache_;
+	NeuralEvaluator neuralEvaluator_;
+	EnsembleEvaluator ensembleEvaluator_;
+	size_t maxSessions_;
+
+	mutex mutex_;
+	condition_variable sessionEnded_;
+	size_t activeSessions_ = 0;
+	long long gamesPlayed_ = 0;
+	Clock::time_point started_;
+};
+
+#endif  //__SERVER_H
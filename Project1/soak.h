@@ -0,0 +1,376 @@
+#ifndef __SOAK_H
+#define __SOAK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "allocation-counter.h"
+#include "bit-board.h"
+#include "bot-config.h"
+#include "bot-parser.h"
+#include "bot-starter.h"
+#include "move.h"
+#include "perft.h"
+#include "piece-table.h"
+
+#ifdef __linux__
+#include <malloc.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/**
+ * Soak run: plays game after game against an engine inside the process,
+ * through BotParser and the same text protocol as a match, every game with
+ * a new BotStarter like a server session. The engine is the stream the
+ * parser reads from and writes to, it produces the next round when the
+ * parser asks for input and applies the moves the parser flushed. Rounds
+ * are cut into windows, each reports resident memory, heap in use and the
+ * percentiles of the action latency, from the action line handed to the
+ * parser to the moves coming back. The run fails when the last window
+ * holds more memory than the baseline window by more than the allowed
+ * growth, or its p99 latency is more than the allowed factor above the
+ * baseline one. The first window is the warm-up, the second one is the
+ * baseline when there are three or more.
+ */
+class SoakBenchmark : public streambuf {
+public:
+	explicit SoakBenchmark(const BotConfig& config)
+		: config_(config), log_(cerr.rdbuf()), random_(17), board_(kWidth, kHeight)
+	{
+		windowRounds_ = max(1LL, config.soakRounds / kWindows);
+		latencies_.reserve(static_cast<size_t>(windowRounds_));
+		input_.reserve(kReservedInput);
+		reply_.reserve(kReservedReply);
+		setp(writeBuffer_, writeBuffer_ + kBufferSize);
+	}
+
+	SoakBenchmark(const SoakBenchmark&) = delete;
+	SoakBenchmark& operator=(const SoakBenchmark&) = delete;
+
+	// Plays until config.soakRounds actions were answered, returns 1 if memory or latency drifted.
+	int Run()
+	{
+		istream in(this);
+		ostream out(this);
+
+		log_ << "soak: " << config_.soakRounds << " rounds in windows of " << windowRounds_ << ", at most " << kMaxGameRounds
+			<< " rounds a game" << endl;
+
+		//The statistics each game prints would bury the window reports
+		streambuf* const errors = cerr.rdbuf(nullptr);
+
+		while (totalRounds_ < config_.soakRounds)
+		{
+			StartGame();
+
+			BotStarter bot(config_);
+			BotParser parser(bot);
+			parser.Run(in, out);
+
+			in.clear();
+			games_++;
+		}
+
+		cerr.rdbuf(errors);
+		return Verdict();
+	}
+
+protected:
+	int_type underflow() override
+	{
+		if (awaitingReply_)
+		{
+			ApplyReply();
+		}
+
+		if (gameOver_ || totalRounds_ >= config_.soakRounds)
+		{
+			return traits_type::eof();
+		}
+
+		WriteRound();
+		setg(&input_[0], &input_[0], &input_[0] + input_.size());
+
+		actionStart_ = Clock::now();
+		awaitingReply_ = true;
+		return traits_type::to_int_type(*gptr());
+	}
+
+	int_type overflow(int_type c) override
+	{
+		sync();
+		if (!traits_type::eq_int_type(c, traits_type::eof()))
+		{
+			*pptr() = traits_type::to_char_type(c);
+			pbump(1);
+		}
+		return traits_type::not_eof(c);
+	}
+
+	//The parser flushes once the moves are written, that ends the action
+	int sync() override
+	{
+		reply_.append(pbase(), pptr());
+		setp(writeBuffer_, writeBuffer_ + kBufferSize);
+
+		if (awaitingReply_ && !replied_ && reply_.find('\n') != string::npos)
+		{
+			replied_ = true;
+			latencies_.push_back(static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(Clock::now() - actionStart_).count()));
+		}
+		return 0;
+	}
+
+private:
+	typedef chrono::steady_clock Clock;
+
+	static const int kWidth = 10;
+	static const int kHeight = 20;
+	static const int kWindows = 20;
+	// Games that survive this long end anyway, so that bots keep being created.
+	static const int kMaxGameRounds = 5000;
+	// A garbage row every kGarbageRounds rounds, a solid one on the rounds of the engine so the critical boards of SearchExtension come up.
+	static const int kGarbageRounds = 12;
+	static const int kBufferSize = 256;
+	static const size_t kReservedInput = 4096;
+	static const size_t kReservedReply = 256;
+
+	struct Window {
+		long long rounds;
+		long long games;
+		double residentMb;
+		double heapMb;
+		double p50Micros;
+		double p99Micros;
+		double maxMicros;
+	};
+
+	void StartGame()
+	{
+		board_ = BitBoard(kWidth, kHeight);
+		current_ = static_cast<int>(random_() % PieceTable::kShapeCount);
+		next_ = static_cast<int>(random_() % PieceTable::kShapeCount);
+		round_ = 0;
+		rowPoints_ = 0;
+		gameOver_ = false;
+		awaitingReply_ = false;
+		replied_ = false;
+		reply_.clear();
+	}
+
+	//Settings before the first round, then the updates of one round and the action
+	void WriteRound()
+	{
+		char line[512];
+		input_.clear();
+
+		if (round_ == 0)
+		{
+			snprintf(line, sizeof(line), "settings timebank 10000\nsettings time_per_move 500\nsettings player_names player1,player2\n"
+				"settings your_bot player1\nsettings field_width %d\nsettings field_height %d\n", kWidth, kHeight);
+			input_ += line;
+		}
+		round_++;
+
+		snprintf(line, sizeof(line), "update game round %d\nupdate game this_piece_type %c\nupdate game next_piece_type %c\n"
+			"update game this_piece_position %d,-1\nupdate player1 row_points %d\nupdate player1 combo 0\n",
+			round_, ShapeName(current_), ShapeName(next_), (kWidth - PieceTable::BoxSize(current_)) / 2, rowPoints_);
+		input_ += line;
+
+		//Both players see the same field, with the falling piece in it like the engine sends it
+		input_ += "update player1 field ";
+		const auto fieldStart = input_.size();
+		perft_.AppendField(board_, current_, input_);
+		input_ += '\n';
+		const auto fieldEnd = input_.size();
+		input_ += "update player2 field ";
+		input_.append(input_, fieldStart, fieldEnd - fieldStart);
+
+		input_ += "action moves 10000\n";
+	}
+
+	//Plays the reply on the board, then clears lines and adds garbage like the engine
+	void ApplyReply()
+	{
+		awaitingReply_ = false;
+
+		//Moves past the longest list the bot builds are ignored
+		Move::MoveType moves[BotStarter::kMaxMoveSet];
+		const auto end = reply_.find('\n');
+		const auto count = replied_ && end != string::npos ? Move::ParseMoves(reply_, end, moves, BotStarter::kMaxMoveSet) : -1;
+		const auto valid = count >= 0;
+
+		reply_.clear();
+		replied_ = false;
+		totalRounds_++;
+
+		Placement placement;
+		if (!valid || !perft_.Play(board_, current_, moves, count, placement))
+		{
+			gameOver_ = true;
+		}
+		else
+		{
+			board_.Place(current_, placement.rotation, placement.x, placement.y);
+			rowPoints_ += board_.ClearLines();
+
+			if (round_ % kGarbageRounds == 0 && !board_.PushRow(static_cast<int>(random_() % kWidth)))
+			{
+				gameOver_ = true;
+			}
+			if (round_ % BitBoard::kRoundsPerSolidRow == 0 && !board_.PushRow(-1))
+			{
+				gameOver_ = true;
+			}
+		}
+
+		current_ = next_;
+		next_ = static_cast<int>(random_() % PieceTable::kShapeCount);
+		gameOver_ = gameOver_ || round_ >= kMaxGameRounds;
+
+		if (totalRounds_ % windowRounds_ == 0 || totalRounds_ == config_.soakRounds)
+		{
+			CloseWindow();
+		}
+	}
+
+	void CloseWindow()
+	{
+		Window window = {};
+		window.rounds = totalRounds_;
+		window.games = games_ + 1;
+		window.residentMb = ResidentBytes() / (1024.0 * 1024.0);
+		window.heapMb = HeapBytes() / (1024.0 * 1024.0);
+
+		if (!latencies_.empty())
+		{
+			window.p50Micros = Percentile(0.50);
+			window.p99Micros = Percentile(0.99);
+			window.maxMicros = *max_element(latencies_.begin(), latencies_.end()) / 1000.0;
+		}
+		latencies_.clear();
+
+		char line[256];
+		snprintf(line, sizeof(line), "window %d: %lld rounds, %lld games, rss %.1f MB, heap %.1f MB, latency p50 %.1f us p99 %.1f us max %.1f us",
+			static_cast<int>(windows_.size()), window.rounds, window.games, window.residentMb, window.heapMb, window.p50Micros,
+			window.p99Micros, window.maxMicros);
+		log_ << line << endl;
+
+		windows_.push_back(window);
+	}
+
+	static char ShapeName(const int shape)
+	{
+		static const char names[PieceTable::kShapeCount + 1] = "IJLOSTZ";
+		return names[shape];
+	}
+
+	double Percentile(const double fraction)
+	{
+		const auto index = min(latencies_.size() - 1, static_cast<size_t>(fraction * latencies_.size()));
+		nth_element(latencies_.begin(), latencies_.begin() + index, latencies_.end());
+		return latencies_[index] / 1000.0;
+	}
+
+	int Verdict()
+	{
+		//The counter reports each action on cerr, which is silenced during the games
+		const auto allocationFailures = AllocationCounter::Failures().load();
+		if (allocationFailures > 0)
+		{
+			log_ << "soak: " << allocationFailures << " actions made heap allocations after the warm-up" << endl;
+		}
+
+		if (windows_.size() < 2)
+		{
+			log_ << "soak: too few rounds to compare windows" << endl;
+			if (allocationFailures > 0)
+			{
+				log_ << "soak: FAILED" << endl;
+				return 1;
+			}
+			return 0;
+		}
+
+		const Window& baseline = windows_[windows_.size() >= 3 ? 1 : 0];
+		const Window& last = windows_.back();
+		const auto memoryGrowth = last.residentMb - baseline.residentMb;
+		const auto latencyGrowth = baseline.p99Micros > 0.0 ? last.p99Micros / baseline.p99Micros : 1.0;
+
+		char line[256];
+		snprintf(line, sizeof(line), "soak: %lld games, rss grew %.1f MB (limit %.1f), heap %.1f to %.1f MB, p99 x%.2f (limit x%.2f)", games_,
+			memoryGrowth, static_cast<double>(config_.soakMemoryGrowthMb), baseline.heapMb, last.heapMb, latencyGrowth, config_.soakLatencyGrowth);
+		log_ << line << endl;
+
+		if (memoryGrowth > static_cast<double>(config_.soakMemoryGrowthMb) || latencyGrowth > config_.soakLatencyGrowth || allocationFailures > 0)
+		{
+			log_ << "soak: FAILED" << endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	// Resident set of the process, 0 where it cannot be read.
+	static double ResidentBytes()
+	{
+#ifdef __linux__
+		long long pages = 0;
+		long long resident = 0;
+		FILE* statm = fopen("/proc/self/statm", "r");
+		if (statm != nullptr)
+		{
+			if (fscanf(statm, "%lld %lld", &pages, &resident) != 2)
+			{
+				resident = 0;
+			}
+			fclose(statm);
+		}
+		return static_cast<double>(resident) * sysconf(_SC_PAGESIZE);
+#else
+		return 0.0;
+#endif
+	}
+
+	// Bytes the allocator handed out and did not get back, 0 where it cannot tell.
+	static double HeapBytes()
+	{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+		return static_cast<double>(mallinfo2().uordblks);
+#else
+		return 0.0;
+#endif
+	}
+
+	BotConfig config_;
+	ostream log_;
+	mt19937 random_;
+	Perft perft_;
+	BitBoard board_;
+	int current_ = 0;
+	int next_ = 0;
+	int round_ = 0;
+	int rowPoints_ = 0;
+	bool gameOver_ = false;
+	bool awaitingReply_ = false;
+	bool replied_ = false;
+	long long totalRounds_ = 0;
+	long long games_ = 0;
+	long long windowRounds_;
+	Clock::time_point actionStart_;
+	vector<uint64_t> latencies_;
+	vector<Window> windows_;
+	string input_;
+	string reply_;
+	char writeBuffer_[kBufferSize];
+};
+
+#endif  // __SOAK_H
@@ -0,0 +1,115 @@
+#ifndef __TIME_MANAGER_H
+#define __TIME_MANAGER_H
+
+#include <algorithm>
+#include <chrono>
+
+#include "field.h"
+
+using namespace std;
+
+/**
+ * Decides how much of the timebank each action may spend.
+ * The engine reports the remaining bank with every action and refills it
+ * by time_per_move each round, so spending time_per_move is sustainable.
+ * Dangerous boards get more than that, quiet boards less, and the
+ * measured I/O overhead plus a fixed safety margin are always held back.
+ */
+class TimeManager {
+public:
+	typedef chrono::steady_clock Clock;
+
+	void SetLimits(const int maxTimebank, const int timePerMove)
+	{
+		m_maxTimebank = maxTimebank;
+		m_timePerMove = timePerMove;
+	}
+
+	//Starts timing an action and returns the deadline the search must respect
+	Clock::time_point StartAction(const long long timebank, const Field& field)
+	{
+		m_actionStart = Clock::now();
+		m_danger = Danger(field);
+		m_budgetMs = Budget(timebank, m_danger);
+		m_deadline = m_actionStart + chrono::milliseconds(m_budgetMs);
+
+		return m_deadline;
+	}
+
+	//Marks the end of the search, the rest of the action is protocol overhead
+	void FinishSearch()
+	{
+		m_searchEnd = Clock::now();
+	}
+
+	//Called once the answer has been written and flushed
+	void FinishAction()
+	{
+		const auto now = Clock::now();
+		const auto overheadMs = chrono::duration<double, milli>(now - m_searchEnd).count();
+
+		//Keep a slowly decaying maximum so a single slow write is remembered
+		m_ioOverheadMs = max(overheadMs, m_ioOverheadMs * 0.9);
+		m_lastActionMs = chrono::duration<double, milli>(now - m_actionStart).count();
+	}
+
+	bool Expired() const { return Clock::now() >= m_deadline; }
+
+	Clock::time_point Deadline() const { return m_deadline; }
+
+	long long BudgetMs() const { return m_budgetMs; }
+
+	double DangerLevel() const { return m_danger; }
+
+	double IoOverheadMs() const { return m_ioOverheadMs; }
+
+	double LastActionMs() const { return m_lastActionMs; }
+
+private:
+	//Danger in [0, 1] from stack height, buried holes and solid rows
+	static double Danger(const Field& field)
+	{
+		const auto playableRows = max(1, field.height() - field.SolidRowCount());
+		const auto heightRatio = static_cast<double>(field.MaxColumnHeight() - field.SolidRowCount()) / playableRows;
+		const auto holeRatio = min(1.0, field.HoleCount() / 12.0);
+		const auto solidRatio = static_cast<double>(field.SolidRowCount()) / field.height();
+
+		return min(1.0, max(0.0, 0.6 * heightRatio + 0.25 * holeRatio + 0.15 * solidRatio));
+	}
+
+	long long Budget(const long long timebank, const double danger) const
+	{
+		const auto reserve = static_cast<long long>(m_safetyMarginMs + m_ioOverheadMs + 0.5);
+		const auto spendable = timebank - reserve;
+
+		if (spendable <= 0)
+		{
+			return 0;
+		}
+
+		//Quiet boards run on half the refill, dangerous ones may dip into the surplus bank
+		const auto surplus = max(0LL, timebank - m_timePerMove);
+		auto wanted = static_cast<long long>(m_timePerMove * (0.5 + danger) + surplus * danger * danger * 0.25);
+
+		//The bank is capped, whatever the next refill would push over the cap is lost anyway
+		wanted += max(0LL, timebank + m_timePerMove - m_maxTimebank);
+
+		return min(spendable, wanted);
+	}
+
+	const double m_safetyMarginMs = 15.0;
+
+	int m_maxTimebank = 10000;
+	int m_timePerMove = 500;
+
+	double m_danger = 0.0;
+	double m_ioOverheadMs = 0.0;
+	double m_lastActionMs = 0.0;
+	long long m_budgetMs = 0;
+
+	Clock::time_point m_actionStart;
+	Clock::time_point m_searchEnd;
+	Clock::time_point m_deadline;
+};
+
+#endif  // __TIME_MANAGER_H
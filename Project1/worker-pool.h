@@ -0,0 +1,223 @@
+#ifndef __WORKER_POOL_H
+#define __WORKER_POOL_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Fixed set of worker threads shared by every client of the process.
+ * Each client gets its own FIFO queue and workers serve the queues
+ * round-robin, so one busy client cannot starve the others.
+ * Jobs must not call back into the pool, a full pool would deadlock.
+ * Execute queues a job that lives on the caller's stack and points at the
+ * caller's function, so once a client has its queue it does not allocate.
+ */
+class WorkerPool {
+public:
+	typedef chrono::steady_clock Clock;
+
+	// Per client latency accounting, all times in milliseconds.
+	struct ClientStats {
+		long long jobs = 0;
+		double totalWaitMs = 0.0;
+		double maxWaitMs = 0.0;
+		double totalRunMs = 0.0;
+		double maxRunMs = 0.0;
+	};
+
+	explicit WorkerPool(unsigned int threadCount) {
+		if (threadCount == 0) {
+			threadCount = max(1u, thread::hardware_concurrency());
+		}
+		for (unsigned int i = 0; i < threadCount; ++i) {
+			workers_.emplace_back([this] { WorkerLoop(); });
+		}
+	}
+
+	~WorkerPool() {
+		{
+			lock_guard<mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		wakeWorkers_.notify_all();
+		for (thread& worker : workers_) {
+			worker.join();
+		}
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	size_t size() const { return workers_.size(); }
+
+	// Queues a job for the client and blocks until a worker has run it.
+	void Execute(int client, const function<void()>& work) {
+		Job job;
+		job.work = &work;
+		job.queued = Clock::now();
+
+		unique_lock<mutex> lock(mutex_);
+		queues_[client].Push(&job);
+		wakeWorkers_.notify_one();
+		jobDone_.wait(lock, [&job] { return job.done; });
+	}
+
+	// Runs body(i) for every i in [begin, end) on the pool and waits for all of them.
+	void ParallelFor(int client, int begin, int end, const function<void(int)>& body) {
+		if (end - begin <= 1 || workers_.size() == 1) {
+			for (int i = begin; i < end; ++i) {
+				body(i);
+			}
+			return;
+		}
+
+		vector<Job> jobs(end - begin);
+		{
+			lock_guard<mutex> lock(mutex_);
+			for (int i = begin; i < end; ++i) {
+				Job& job = jobs[i - begin];
+				job.body = &body;
+				job.index = i;
+				job.queued = Clock::now();
+				queues_[client].Push(&job);
+			}
+		}
+		wakeWorkers_.notify_all();
+
+		unique_lock<mutex> lock(mutex_);
+		jobDone_.wait(lock, [&jobs] {
+			for (const Job& job : jobs) {
+				if (!job.done) {
+					return false;
+				}
+			}
+			return true;
+		});
+	}
+
+	ClientStats Stats(int client) {
+		lock_guard<mutex> lock(mutex_);
+		return stats_[client];
+	}
+
+	// Drops the queue and statistics of a client that has gone away.
+	void Forget(int client) {
+		lock_guard<mutex> lock(mutex_);
+		queues_.erase(client);
+		stats_.erase(client);
+	}
+
+private:
+	// Either work or body(index) is run.
+	struct Job {
+		const function<void()>* work = nullptr;
+		const function<void(int)>* body = nullptr;
+		int index = 0;
+		Clock::time_point queued;
+		Job* next = nullptr;
+		bool done = false;
+	};
+
+	// FIFO linked through the jobs themselves.
+	struct Queue {
+		Job* head = nullptr;
+		Job* tail = nullptr;
+
+		bool empty() const { return head == nullptr; }
+
+		void Push(Job* job) {
+			job->next = nullptr;
+			if (tail != nullptr) {
+				tail->next = job;
+			}
+			else {
+				head = job;
+			}
+			tail = job;
+		}
+
+		Job* Pop() {
+			Job* job = head;
+			head = job->next;
+			if (head == nullptr) {
+				tail = nullptr;
+			}
+			return job;
+		}
+	};
+
+	void WorkerLoop() {
+		unique_lock<mutex> lock(mutex_);
+		while (true) {
+			int client = 0;
+			Job* job = nullptr;
+			wakeWorkers_.wait(lock, [&] { return stopping_ || NextJob(client, job); });
+			if (job == nullptr) {
+				return;
+			}
+
+			const auto started = Clock::now();
+			lock.unlock();
+			if (job->work != nullptr) {
+				(*job->work)();
+			}
+			else {
+				(*job->body)(job->index);
+			}
+			const auto finished = Clock::now();
+			lock.lock();
+
+			ClientStats& stats = stats_[client];
+			const double waitMs = chrono::duration<double, milli>(started - job->queued).count();
+			const double runMs = chrono::duration<double, milli>(finished - started).count();
+			stats.jobs++;
+			stats.totalWaitMs += waitMs;
+			stats.maxWaitMs = max(stats.maxWaitMs, waitMs);
+			stats.totalRunMs += runMs;
+			stats.maxRunMs = max(stats.maxRunMs, runMs);
+
+			job->done = true;
+			jobDone_.notify_all();
+		}
+	}
+
+	// Picks the oldest job of the next client after the one served last.
+	bool NextJob(int& client, Job*& job) {
+		if (queues_.empty()) {
+			return false;
+		}
+		auto it = queues_.upper_bound(lastClient_);
+		for (size_t tried = 0; tried <= queues_.size(); ++tried) {
+			if (it == queues_.end()) {
+				it = queues_.begin();
+			}
+			if (!it->second.empty()) {
+				client = it->first;
+				job = it->second.Pop();
+				lastClient_ = client;
+				return true;
+			}
+			++it;
+		}
+		return false;
+	}
+
+	vector<thread> workers_;
+	mutex mutex_;
+	condition_variable wakeWorkers_;
+	condition_variable jobDone_;
+	map<int, Queue> queues_;
+	map<int, ClientStats> stats_;
+	int lastClient_ = -1;
+	bool stopping_ = false;
+};
+
+#endif  //__WORKER_POOL_H